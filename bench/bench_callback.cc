@@ -0,0 +1,114 @@
+#include "../src/scheduler/scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace colib;
+
+/*
+ * 统计每次调度的内存分配次数
+ * 1. 只看任务对象：构造 -> 放进任务 -> 从队列取出，std::function与Callback对比
+ * 2. 端到端：预热之后向Scheduler投递N个回调并等待全部执行完
+ * 回调捕获三个指针和一个fd，和IO处理函数的大小相当
+ */
+static std::atomic<long> s_allocs{0};
+
+void *operator new(size_t size)
+{
+  s_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static const long N = 100000;
+
+struct Conn
+{
+  long handled = 0;
+};
+
+static std::atomic<long> s_done{0};
+
+static void handle(Conn *conn, void *buf, void *ctx, int fd)
+{
+  conn->handled += fd + (buf != ctx);
+  s_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class Fn>
+static void taskPath(const char *name)
+{
+  Conn conn;
+  char buf[16];
+  long before = s_allocs.load();
+  for (long i = 0; i < N; ++i)
+  {
+    int fd = (int)i;
+    // 旧实现：按值传入ScheduleTask时拷贝一次，task = *it再拷贝一次
+    Fn f = [c = &conn, b = (void *)buf, x = (void *)&conn, fd]()
+    { handle(c, b, x, fd); };
+    Fn queued(std::move(f));
+    Fn task(std::move(queued));
+    task();
+  }
+  printf("  %-16s %6.2f allocs/task\n", name, (double)(s_allocs.load() - before) / N);
+}
+
+// 驱动协程每轮投递BURST个回调后把自己排到队尾，下一轮开始时这一轮的回调都已执行完
+static const long BURST = 1000;
+static long s_allocsBefore = 0;
+static std::chrono::steady_clock::time_point s_start;
+
+static void schedulerPath()
+{
+  Scheduler sc(1, true, "bench");
+  sc.start();
+
+  Conn conn;
+  char buf[16];
+  const long warmup_rounds = 10;
+  const long rounds = warmup_rounds + N / BURST;
+  sc.scheduleLock([&]()
+                  {
+    for (long r = 0; r < rounds; ++r)
+    {
+      if (r == warmup_rounds)
+      {
+        s_allocsBefore = s_allocs.load();
+        s_start = std::chrono::steady_clock::now();
+      }
+      for (long i = 0; i < BURST; ++i)
+      {
+        int fd = (int)i;
+        sc.scheduleLock([c = &conn, b = (void *)buf, x = (void *)&conn, fd]()
+                        { handle(c, b, x, fd); });
+      }
+      sc.scheduleLock(Fiber::GetThis());
+      Fiber::GetThis()->yield();
+    } });
+  sc.stop();
+
+  auto cost = std::chrono::steady_clock::now() - s_start;
+  long allocs = s_allocs.load() - s_allocsBefore;
+  printf("  %-16s %6.2f allocs/dispatch, %.1f ns/dispatch\n", "Scheduler",
+         (double)allocs / N, std::chrono::duration<double, std::nano>(cost).count() / N);
+}
+
+int main()
+{
+  printf("task object, %ld tasks, capture size %zu bytes\n", N, sizeof(void *) * 3 + sizeof(int));
+  taskPath<std::function<void()>>("std::function");
+  taskPath<Callback>("Callback");
+
+  printf("end to end, %ld callbacks after warm-up\n", N);
+  schedulerPath();
+  return 0;
+}
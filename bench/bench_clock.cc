@@ -0,0 +1,102 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <dlfcn.h>
+#include <thread>
+#include <time.h>
+
+using namespace colib;
+
+/*
+ * 定时器的时钟读取
+ * 读取开销：steady_clock（CLOCK_MONOTONIC）和CLOCK_MONOTONIC_COARSE每次读取的时间
+ * 读取次数：替换clock_gettime和epoll_wait计数，一个协程在IO协程调度器中反复等待1毫秒的定时器，
+ * 统计idle每一轮（一次epoll_wait）读取了几次时钟；再统计添加+取消一个定时器读取几次
+ */
+static const int READS = 10000000;
+static const int SLEEPS = 2000;
+static const int TIMERS = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_reads{0};
+static std::atomic<long> s_waits{0};
+
+// 替换libc的clock_gettime，统计调用次数
+extern "C" int clock_gettime(clockid_t id, struct timespec *ts)
+{
+  typedef int (*clock_gettime_fun)(clockid_t, struct timespec *);
+  static clock_gettime_fun real = (clock_gettime_fun)dlsym(RTLD_NEXT, "clock_gettime");
+  s_reads.fetch_add(1, std::memory_order_relaxed);
+  return real(id, ts);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+  static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return real(epfd, events, maxevents, timeout);
+}
+
+static double readCost(clockid_t id)
+{
+  timespec ts;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < READS; ++i)
+  {
+    clock_gettime(id, &ts);
+  }
+  return std::chrono::duration<double>(Clock::now() - start).count() * 1e9 / READS;
+}
+
+static void run(TimerManager::ClockSource source, const char *name)
+{
+  IOManager iom(1, false, "clock");
+  iom.setClockSource(source);
+  std::atomic<bool> done{false};
+  long sleep_reads = 0;
+  long sleep_waits = 0;
+  long timer_reads = 0;
+  double timer_sec = 0;
+  iom.scheduleLock([&]()
+                   {
+    std::shared_ptr<Fiber> self = Fiber::GetThis();
+    long start = s_reads;
+    long waits = s_waits;
+    for (int i = 0; i < SLEEPS; ++i)
+    {
+      IOManager::GetThis()->addTimer(1, [self]()
+                                     { IOManager::GetThis()->scheduleLock(self); });
+      self->yield();
+    }
+    sleep_reads = s_reads - start;
+    sleep_waits = s_waits - waits;
+
+    start = s_reads;
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < TIMERS; ++i)
+    {
+      IOManager::GetThis()->addTimer(10000, []() {})->cancel();
+    }
+    timer_sec = std::chrono::duration<double>(Clock::now() - t0).count();
+    timer_reads = s_reads - start - 2;
+    done = true; });
+  while (!done)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  printf("  %-16s  %6.2f idle loops per 1 ms sleep, %4.2f clock reads per loop   add+cancel %4.0f ns, %4.2f reads\n",
+         name, (double)sleep_waits / SLEEPS, (double)sleep_reads / sleep_waits, timer_sec * 1e9 / TIMERS,
+         (double)timer_reads / TIMERS);
+}
+
+int main()
+{
+  printf("clock_gettime  MONOTONIC %5.1f ns   MONOTONIC_COARSE %5.1f ns\n",
+         readCost(CLOCK_MONOTONIC), readCost(CLOCK_MONOTONIC_COARSE));
+  run(TimerManager::MONOTONIC, "MONOTONIC");
+  run(TimerManager::MONOTONIC_COARSE, "MONOTONIC_COARSE");
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "../src/fiber/fiber.h"
+#include <ucontext.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace colib;
+
+/*
+ * 协程切换开销
+ * 每个用例做N次"切入-切出"往返，输出单次切换(半个往返)的平均耗时
+ */
+static const long N = 2000000;
+static const size_t STACK_SIZE = 128 * 1024;
+
+static double nsPerSwitch(std::chrono::steady_clock::duration d, long round_trips)
+{
+  return std::chrono::duration<double, std::nano>(d).count() / (round_trips * 2);
+}
+
+/* glibc swapcontext */
+static ucontext_t s_main_uctx, s_co_uctx;
+
+static void ucontextLoop()
+{
+  while (true)
+  {
+    swapcontext(&s_co_uctx, &s_main_uctx);
+  }
+}
+
+static double benchUcontext()
+{
+  void *stack = malloc(STACK_SIZE);
+  getcontext(&s_co_uctx);
+  s_co_uctx.uc_link = nullptr;
+  s_co_uctx.uc_stack.ss_sp = stack;
+  s_co_uctx.uc_stack.ss_size = STACK_SIZE;
+  makecontext(&s_co_uctx, ucontextLoop, 0);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < N; ++i)
+  {
+    swapcontext(&s_main_uctx, &s_co_uctx);
+  }
+  auto cost = std::chrono::steady_clock::now() - start;
+  free(stack);
+  return nsPerSwitch(cost, N);
+}
+
+/* colib::Context，编译时选择的后端 */
+static Context s_main_ctx, s_co_ctx;
+
+static void contextLoop()
+{
+  while (true)
+  {
+    s_co_ctx.swapTo(s_main_ctx);
+  }
+}
+
+static double benchContext()
+{
+  void *stack = malloc(STACK_SIZE);
+  s_co_ctx.make(stack, STACK_SIZE, contextLoop);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < N; ++i)
+  {
+    s_main_ctx.swapTo(s_co_ctx);
+  }
+  auto cost = std::chrono::steady_clock::now() - start;
+  free(stack);
+  return nsPerSwitch(cost, N);
+}
+
+/* Fiber::resume/yield，包含状态维护 */
+static double benchFiber()
+{
+  Fiber::GetThis();
+  bool done = false;
+  std::shared_ptr<Fiber> fiber = std::make_shared<Fiber>([&done]()
+                                                         {
+    while (!done) {
+      Fiber::GetThis()->yield();
+    } }, 0, false);
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < N; ++i)
+  {
+    fiber->resume();
+  }
+  auto cost = std::chrono::steady_clock::now() - start;
+  done = true;
+  fiber->resume();
+  return nsPerSwitch(cost, N);
+}
+
+int main()
+{
+  printf("context backend: %s, %ld round trips\n", Context::BackendName(), N);
+  printf("%-24s %8.1f ns/switch\n", "swapcontext (glibc)", benchUcontext());
+  printf("%-24s %8.1f ns/switch\n", Context::BackendName(), benchContext());
+  printf("%-24s %8.1f ns/switch\n", "Fiber resume/yield", benchFiber());
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * hook之后的阻塞风格echo服务
+ * 服务端和客户端都写成普通的阻塞代码：accept/read/write/connect，在IO协程调度器中由hook变成协程切换
+ * CONNS个客户端协程同时连接，各自做ROUNDS次64字节的往返，所有协程只运行在少数几个线程上
+ */
+static const int CONNS = 2000;
+static const int ROUNDS = 100;
+static const int MSG = 64;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_roundTrips{0};
+static std::atomic<int> s_clientsDone{0};
+static std::atomic<int> s_connected{0};
+static std::atomic<int> s_maxConcurrent{0};
+
+static void serve(int fd)
+{
+  char buf[MSG];
+  while (true)
+  {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+    {
+      break;
+    }
+    if (write(fd, buf, n) != n)
+    {
+      break;
+    }
+  }
+  close(fd);
+}
+
+static void acceptLoop(int listen_fd)
+{
+  while (true)
+  {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      break;
+    }
+    IOManager::GetThis()->scheduleLock([fd]()
+                                       { serve(fd); });
+  }
+}
+
+static void client(sockaddr_in addr)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    perror("connect");
+    close(fd);
+    ++s_clientsDone;
+    return;
+  }
+  int now = ++s_connected;
+  int prev = s_maxConcurrent;
+  while (now > prev && !s_maxConcurrent.compare_exchange_weak(prev, now))
+    ;
+
+  char buf[MSG];
+  memset(buf, 'x', sizeof(buf));
+  for (int i = 0; i < ROUNDS; ++i)
+  {
+    if (write(fd, buf, sizeof(buf)) != MSG)
+    {
+      break;
+    }
+    size_t got = 0;
+    while (got < sizeof(buf))
+    {
+      ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+      if (n <= 0)
+      {
+        break;
+      }
+      got += n;
+    }
+    if (got != sizeof(buf))
+    {
+      break;
+    }
+    ++s_roundTrips;
+  }
+  --s_connected;
+  close(fd);
+  ++s_clientsDone;
+}
+
+static void run(int threads)
+{
+  s_roundTrips = 0;
+  s_clientsDone = 0;
+  s_maxConcurrent = 0;
+  double sec = 0;
+  {
+    IOManager iom(threads, false, "echo");
+    std::atomic<int> listen_fd{-1};
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    iom.scheduleLock([&]()
+                     {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      socklen_t len = sizeof(addr);
+      if (bind(fd, (sockaddr *)&addr, sizeof(addr)) || listen(fd, 4096) ||
+          getsockname(fd, (sockaddr *)&addr, &len))
+      {
+        perror("listen");
+      }
+      listen_fd = fd;
+      acceptLoop(fd); });
+    while (listen_fd < 0)
+    {
+      std::this_thread::yield();
+    }
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < CONNS; ++i)
+    {
+      iom.scheduleLock([addr]()
+                       { client(addr); });
+    }
+    while (s_clientsDone < CONNS)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    // 关闭监听fd会唤醒阻塞在accept中的协程，accept返回错误后退出
+    iom.scheduleLock([&]()
+                     { close(listen_fd); });
+  }
+  printf("  threads=%d  %d fibers blocked at once  %8.0f round trips/s  %.2fs\n", threads,
+         s_maxConcurrent.load(), s_roundTrips / sec, sec);
+}
+
+int main()
+{
+  rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  printf("%d client fibers x %d round trips of %d bytes, blocking-style code\n", CONNS, ROUNDS, MSG);
+  for (int threads : {1, 2, 4})
+  {
+    run(threads);
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 一次投递10k个任务：逐个scheduleLock与scheduleBatch对比
+ * 分别从外部线程（注入队列）和工作线程内部（本地队列）投递，
+ * 工作线程开始时都在epoll_wait里空闲，统计投递本身的耗时和全部执行完的耗时
+ */
+static const long N = 10000;
+static const int ROUNDS = 20;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_done{0};
+
+static void work()
+{
+  s_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void fanout(Scheduler *sc, bool batch)
+{
+  if (batch)
+  {
+    std::vector<Callback> cbs;
+    cbs.reserve(N);
+    for (long i = 0; i < N; ++i)
+    {
+      cbs.emplace_back(work);
+    }
+    sc->scheduleBatch(cbs);
+  }
+  else
+  {
+    for (long i = 0; i < N; ++i)
+    {
+      sc->scheduleLock(work);
+    }
+  }
+}
+
+static void run(const char *name, bool inside, bool batch)
+{
+  IOManager iom(4, false, "bench");
+  double post_us = 0, total_us = 0;
+  for (int r = 0; r < ROUNDS; ++r)
+  {
+    // 等工作线程都进入空闲
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    s_done = 0;
+    std::atomic<double> post{0};
+    Clock::time_point start = Clock::now();
+    if (inside)
+    {
+      iom.scheduleLock([&]()
+                       {
+        Clock::time_point t = Clock::now();
+        fanout(&iom, batch);
+        post = std::chrono::duration<double, std::micro>(Clock::now() - t).count(); });
+    }
+    else
+    {
+      fanout(&iom, batch);
+      post = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
+    while (s_done.load() < N)
+    {
+      std::this_thread::yield();
+    }
+    total_us += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    post_us += post;
+  }
+  printf("  %-34s post %8.1f us   total %8.1f us\n", name, post_us / ROUNDS, total_us / ROUNDS);
+}
+
+int main()
+{
+  printf("fan-out of %ld tasks into 4 idle workers, average of %d rounds\n", N, ROUNDS);
+  run("external, scheduleLock loop", false, false);
+  run("external, scheduleBatch", false, true);
+  run("inside worker, scheduleLock loop", true, false);
+  run("inside worker, scheduleBatch", true, true);
+  return 0;
+}
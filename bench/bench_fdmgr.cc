@@ -0,0 +1,119 @@
+#include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include "../src/hook/fd_manager.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * hook的fd上下文开销
+ * 查找：多个线程同时在同一批socket上反复查找fd上下文，每次读写hook都要做一次
+ * 创建：hook中的socket()+close()，新socket的上下文初始化
+ * 标志：设置非阻塞的常见写法 fcntl(F_GETFL) + fcntl(F_SETFL, flags | O_NONBLOCK)，再恢复
+ */
+static const int FDS = 1024;
+static const int LOOKUPS = 4000000;
+static const int CREATES = 100000;
+static const int FLAG_OPS = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+static double lookup(const std::vector<int> &fds, int threads)
+{
+  std::atomic<long> sink{0};
+  std::vector<std::thread> thrs;
+  Clock::time_point start = Clock::now();
+  for (int t = 0; t < threads; ++t)
+  {
+    thrs.emplace_back([&, t]()
+                      {
+      long found = 0;
+      for (int i = 0; i < LOOKUPS; ++i)
+      {
+        auto ctx = FdMgr::GetInstance()->get(fds[(i + t * 7) % FDS]);
+        found += ctx && ctx->isSocket();
+      }
+      sink += found; });
+  }
+  for (auto &thr : thrs)
+  {
+    thr.join();
+  }
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+  if (sink != (long)LOOKUPS * threads)
+  {
+    printf("lookup mismatch\n");
+  }
+  return sec * 1e9 / ((double)LOOKUPS * threads);
+}
+
+// 在开启了hook的IO线程中执行
+static double inFiber(IOManager &iom, std::function<void()> cb)
+{
+  std::atomic<bool> done{false};
+  double sec = 0;
+  iom.scheduleLock([&]()
+                   {
+    Clock::time_point start = Clock::now();
+    cb();
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    done = true; });
+  while (!done)
+  {
+    std::this_thread::yield();
+  }
+  return sec;
+}
+
+int main()
+{
+  rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  std::vector<int> fds;
+  for (int i = 0; i < FDS; ++i)
+  {
+    int fd = socket_f(AF_INET, SOCK_STREAM, 0);
+    FdMgr::GetInstance()->get(fd, true);
+    fds.push_back(fd);
+  }
+
+  printf("fd context lookup, %d sockets\n", FDS);
+  for (int threads : {1, 2, 4})
+  {
+    printf("  threads=%d  %6.2f ns/lookup\n", threads, lookup(fds, threads));
+  }
+
+  IOManager iom(1, false, "fdmgr");
+  double sec = inFiber(iom, []()
+                       {
+    for (int i = 0; i < CREATES; ++i)
+    {
+      close(socket(AF_INET, SOCK_STREAM, 0));
+    } });
+  printf("hooked socket()+close()        %7.0f ns/op\n", sec * 1e9 / CREATES);
+
+  int fd = fds[0];
+  sec = inFiber(iom, [fd]()
+                {
+    for (int i = 0; i < FLAG_OPS; ++i)
+    {
+      int flags = fcntl(fd, F_GETFL);
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+      fcntl(fd, F_SETFL, flags);
+    } });
+  printf("hooked F_GETFL + 2x F_SETFL    %7.0f ns/op\n", sec * 1e9 / FLAG_OPS);
+
+  for (int fd : fds)
+  {
+    close_f(fd);
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * fd表的查找和扩容开销
+ * 连接风暴：把一个管道的读端dup2到越来越大的fd号上，对每个fd做addEvent+delEvent
+ * 第一轮包含fd表的扩容，第二轮只有查找；fd号受RLIMIT_NOFILE限制
+ * 并发：TASKS个任务同时在各自的fd上反复addEvent+delEvent
+ */
+static const int TASKS = 4;
+static const int OPS = 200000;
+
+using Clock = std::chrono::steady_clock;
+
+static int s_pipe[2];
+
+static double storm(IOManager &iom, const std::vector<int> &fds)
+{
+  std::atomic<bool> done{false};
+  double sec = 0;
+  iom.scheduleLock([&]()
+                   {
+    Clock::time_point start = Clock::now();
+    for (int fd : fds)
+    {
+      IOManager::GetThis()->addEvent(fd, IOManager::READ, []() {});
+      IOManager::GetThis()->delEvent(fd, IOManager::READ);
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    done = true; });
+  while (!done)
+  {
+    std::this_thread::yield();
+  }
+  return sec;
+}
+
+static double concurrent(IOManager &iom, const std::vector<int> &fds)
+{
+  std::atomic<int> done{0};
+  Clock::time_point start = Clock::now();
+  for (int t = 0; t < TASKS; ++t)
+  {
+    int fd = fds[fds.size() - 1 - t];
+    iom.scheduleLock([fd, &done]()
+                     {
+      for (int i = 0; i < OPS; ++i)
+      {
+        IOManager::GetThis()->addEvent(fd, IOManager::READ, []() {});
+        IOManager::GetThis()->delEvent(fd, IOManager::READ);
+      }
+      ++done; });
+  }
+  while (done < TASKS)
+  {
+    std::this_thread::yield();
+  }
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main()
+{
+  rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  int max_fd = (int)std::min<rlim_t>(rl.rlim_cur, 1 << 20) - 1;
+
+  if (pipe(s_pipe))
+  {
+    perror("pipe");
+    return 1;
+  }
+  // 从小到大，每次跳过一段，模拟连接风暴中fd号快速增长
+  std::vector<int> fds;
+  for (int fd = 64; fd <= max_fd; fd += 7)
+  {
+    if (dup2(s_pipe[0], fd) == fd)
+    {
+      fds.push_back(fd);
+    }
+  }
+  printf("%zu fds up to %d\n", fds.size(), fds.back());
+
+  for (int threads : {1, 2})
+  {
+    IOManager iom(threads, false, "bench");
+    double first = storm(iom, fds);
+    double second = storm(iom, fds);
+    double conc = concurrent(iom, fds);
+    printf("  threads=%d  storm first pass %7.0f ns/fd  second pass %5.0f ns/fd  "
+           "%d tasks add+del %5.0f ns/op\n",
+           threads, first * 1e9 / fds.size(), second * 1e9 / fds.size(), TASKS,
+           conc * 1e9 / ((double)TASKS * OPS));
+  }
+
+  for (int fd : fds)
+  {
+    close(fd);
+  }
+  return 0;
+}
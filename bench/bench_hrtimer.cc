@@ -0,0 +1,87 @@
+#include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <dlfcn.h>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 亚毫秒定时：一个协程在IO协程调度器中用hook的usleep按固定间隔发送（限速），
+ * 统计实际间隔的平均值和p99，以及每次睡眠idle等待了几次（替换epoll_wait/epoll_pwait2计数）
+ * 默认模式等待时间向上取整到毫秒；高精度模式按纳秒等待
+ */
+static const int SLEEPS = 2000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_waits{0};
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+  static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return real(epfd, events, maxevents, timeout);
+}
+
+extern "C" int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents, const struct timespec *timeout,
+                            const sigset_t *sigmask)
+{
+  typedef int (*epoll_pwait2_fun)(int, struct epoll_event *, int, const struct timespec *, const sigset_t *);
+  static epoll_pwait2_fun real = (epoll_pwait2_fun)dlsym(RTLD_NEXT, "epoll_pwait2");
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return real(epfd, events, maxevents, timeout, sigmask);
+}
+
+static void run(bool high_res, useconds_t interval)
+{
+  IOManager iom(1, false, "hrtimer");
+  iom.setHighResolutionTimers(high_res);
+  std::atomic<bool> done{false};
+  std::vector<double> gaps;
+  long waits = 0;
+  iom.scheduleLock([&]()
+                   {
+    gaps.reserve(SLEEPS);
+    long start = s_waits;
+    Clock::time_point last = Clock::now();
+    for (int i = 0; i < SLEEPS; ++i)
+    {
+      usleep(interval);
+      Clock::time_point now = Clock::now();
+      gaps.push_back(std::chrono::duration<double, std::micro>(now - last).count());
+      last = now;
+    }
+    waits = s_waits - start;
+    done = true; });
+  while (!done)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  double sum = 0;
+  for (double g : gaps)
+  {
+    sum += g;
+  }
+  std::sort(gaps.begin(), gaps.end());
+  printf("  %-9s usleep(%4u)  mean %7.1f us  p50 %7.1f us  p99 %7.1f us  %7.2f waits per sleep\n",
+         high_res ? "high-res" : "default", interval, sum / SLEEPS, gaps[SLEEPS / 2], gaps[SLEEPS * 99 / 100],
+         (double)waits / SLEEPS);
+}
+
+int main()
+{
+  printf("%d hooked usleep per run\n", SLEEPS);
+  for (useconds_t interval : {100, 250, 500, 1500})
+  {
+    run(false, interval);
+    run(true, interval);
+  }
+  return 0;
+}
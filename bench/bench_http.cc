@@ -0,0 +1,172 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * src/main.cc的HTTP应答在共享模式和分片模式下的吞吐
+ * 共享模式：一个监听fd，所有线程共用一个epoll和fd表
+ * 分片模式：每个线程一个SO_REUSEPORT监听fd，连接的事件只在接受它的线程上处理
+ * 客户端线程用阻塞socket短连接：connect、发送请求、读到服务端关闭
+ */
+static const int CLIENTS = 8;
+static const double SECONDS = 2.0;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> s_stopping{false};
+static std::mutex s_listenMutex;
+static std::vector<int> s_listenFds;
+
+static const char *RESPONSE = "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/plain\r\n"
+                              "Content-Length: 13\r\n"
+                              "Connection: keep-alive\r\n"
+                              "\r\n"
+                              "Hello, World!";
+
+static void onAccept(int listen_fd);
+
+static void watchAccept(int listen_fd)
+{
+  if (s_stopping)
+  {
+    return;
+  }
+  IOManager::GetThis()->addEvent(listen_fd, IOManager::READ, [listen_fd]()
+                                 { onAccept(listen_fd); });
+}
+
+static void onAccept(int listen_fd)
+{
+  int fd;
+  while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0)
+  {
+    IOManager::GetThis()->addEvent(fd, IOManager::READ, [fd]()
+                                   {
+      char buf[1024];
+      if (recv(fd, buf, sizeof(buf), 0) > 0)
+      {
+        send(fd, RESPONSE, strlen(RESPONSE), 0);
+      }
+      close(fd); });
+  }
+  watchAccept(listen_fd);
+}
+
+static void client(uint16_t port, std::atomic<bool> &stop, std::atomic<long> &done)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const char *req = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char buf[1024];
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0 && send(fd, req, strlen(req), 0) > 0)
+    {
+      while (recv(fd, buf, sizeof(buf), 0) > 0)
+        ;
+      done.fetch_add(1, std::memory_order_relaxed);
+    }
+    close(fd);
+  }
+}
+
+static void run(int threads, bool sharded, uint16_t port)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  std::atomic<bool> stop{false};
+  std::atomic<long> done{0};
+  double sec = 0;
+  {
+    IOManager iom(threads, false, "http", Reactor::EPOLL, sharded);
+    s_stopping = false;
+    s_listenFds.clear();
+    if (sharded)
+    {
+      bool ok = iom.listenPerWorker((sockaddr *)&addr, sizeof(addr), 1024, [](int fd)
+                                    {
+        {
+          std::lock_guard<std::mutex> lock(s_listenMutex);
+          s_listenFds.push_back(fd);
+        }
+        watchAccept(fd); });
+      if (!ok)
+      {
+        return;
+      }
+    }
+    else
+    {
+      int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      int yes = 1;
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+      if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 1024))
+      {
+        perror("listen");
+        return;
+      }
+      s_listenFds.push_back(listen_fd);
+      iom.scheduleLock([listen_fd]()
+                       { watchAccept(listen_fd); });
+    }
+
+    std::vector<std::thread> clients;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < CLIENTS; ++i)
+    {
+      clients.emplace_back(client, port, std::ref(stop), std::ref(done));
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(SECONDS));
+    stop = true;
+    for (auto &t : clients)
+    {
+      t.join();
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    // 监听fd上还有等待中的事件，取消之后调度器才能停止
+    s_stopping = true;
+    std::lock_guard<std::mutex> lock(s_listenMutex);
+    for (int fd : s_listenFds)
+    {
+      iom.cancelAll(fd);
+    }
+  }
+  for (int fd : s_listenFds)
+  {
+    close(fd);
+  }
+  printf("  %-8s threads=%-2d %8.0f req/s\n", sharded ? "sharded" : "shared", threads, done / sec);
+}
+
+int main()
+{
+  printf("%d clients, short connections, %.0fs per run, %u cpus\n", CLIENTS, SECONDS,
+         std::thread::hardware_concurrency());
+  uint16_t port = 18080;
+  for (int threads : {1, 2, 4})
+  {
+    run(threads, false, port++);
+    run(threads, true, port++);
+  }
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 回环ping-pong的往返延迟和吞吐
+ * 服务端每个连接一个协程：非阻塞read，EAGAIN时addEvent(READ)后yield，读到后原样写回
+ * 客户端每个连接一个线程，阻塞写一个字节再读回来，记录每次往返的时间
+ * 一次性注册时每个请求需要epoll_ctl添加和删除各一次，持久注册时不需要
+ * epoll_ctl在这里被替换成计数之后直接系统调用
+ * busy-poll在持久注册的基础上打开忙轮询，空闲时先轮询BUSY_POLL_US微秒，预算为一个核
+ */
+static const int ROUNDS = 20000;
+static const uint32_t BUSY_POLL_US = 50;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_epollCtl{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+  s_epollCtl.fetch_add(1, std::memory_order_relaxed);
+  return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+static void echo(int fd)
+{
+  char buf[64];
+  while (true)
+  {
+    int n = read(fd, buf, sizeof(buf));
+    if (n > 0)
+    {
+      if (write(fd, buf, n) != n)
+      {
+        break;
+      }
+      continue;
+    }
+    if (n == 0 || errno != EAGAIN)
+    {
+      break;
+    }
+    IOManager::GetThis()->addEvent(fd, IOManager::READ);
+    Fiber::GetThis()->yield();
+  }
+  IOManager::GetThis()->cancelAll(fd);
+  close(fd);
+}
+
+static void client(int fd, std::vector<double> &lat)
+{
+  char c = 'x';
+  lat.reserve(ROUNDS);
+  for (int i = 0; i < ROUNDS; ++i)
+  {
+    Clock::time_point start = Clock::now();
+    if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1)
+    {
+      perror("client");
+      break;
+    }
+    lat.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  close(fd);
+}
+
+static void run(const char *name, int pairs, int threads, bool persistent, uint32_t busy_poll_us)
+{
+  std::vector<std::vector<double>> lats(pairs);
+  double sec = 0;
+  long ctl = 0;
+  {
+    IOManager iom(threads, false, "bench");
+    iom.setPersistentRegistration(persistent);
+    iom.setBusyPoll(busy_poll_us);
+
+    std::vector<std::thread> clients;
+    long ctl0 = s_epollCtl;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < pairs; ++i)
+    {
+      int sv[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+      {
+        perror("socketpair");
+        return;
+      }
+      fcntl(sv[1], F_SETFL, O_NONBLOCK);
+      int fd = sv[1];
+      iom.scheduleLock([fd]()
+                       { echo(fd); });
+      clients.emplace_back(client, sv[0], std::ref(lats[i]));
+    }
+    for (auto &t : clients)
+    {
+      t.join();
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    ctl = s_epollCtl - ctl0;
+  }
+
+  std::vector<double> all;
+  for (auto &lat : lats)
+  {
+    all.insert(all.end(), lat.begin(), lat.end());
+  }
+  std::sort(all.begin(), all.end());
+  printf("  %-11s conns=%d threads=%d  %7.0f round trips/s  p50 %6.1f us  p99 %7.1f us  %.2f epoll_ctl/round trip\n",
+         name, pairs, threads, all.size() / sec, all[all.size() / 2], all[all.size() * 99 / 100],
+         (double)ctl / all.size());
+}
+
+int main()
+{
+  printf("%d round trips per connection\n", ROUNDS);
+  for (int pairs : {1, 4})
+  {
+    for (int threads : {1, 2})
+    {
+      run("oneshot", pairs, threads, false, 0);
+      run("persistent", pairs, threads, true, 0);
+      run("busy-poll", pairs, threads, true, BUSY_POLL_US);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * 指定线程的任务对其它线程出队的影响
+ * 两个工作线程，其中一个被长任务占住，先给它投递P个指定线程的任务（积压着不能执行），
+ * 再投递N个普通任务，统计另一个线程处理完这些普通任务的耗时
+ */
+static const long N = 20000;
+
+static std::atomic<long> s_done{0};
+static std::atomic<int> s_busyThread{0};
+static std::atomic<bool> s_release{false};
+
+static void waitFor(std::atomic<long> &counter, long target)
+{
+  while (counter.load() < target)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+static double run(long pinned)
+{
+  IOManager iom(2, false, "bench");
+  s_done = 0;
+  s_busyThread = 0;
+  s_release = false;
+
+  // 占住一个线程，不让它执行自己信箱里的任务
+  iom.scheduleLock([]()
+                   {
+    s_busyThread = Thread::GetThreadID();
+    while (!s_release)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    } });
+  while (!s_busyThread)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  static std::atomic<long> s_pinnedDone{0};
+  s_pinnedDone = 0;
+  for (long i = 0; i < pinned; ++i)
+  {
+    iom.scheduleLock([]()
+                     { s_pinnedDone++; }, s_busyThread);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < N; ++i)
+  {
+    iom.scheduleLock([]()
+                     { s_done++; });
+  }
+  waitFor(s_done, N);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  s_release = true;
+  waitFor(s_pinnedDone, pinned);
+  return ns / N;
+}
+
+int main()
+{
+  printf("%ld unpinned tasks while pinned tasks wait on a busy thread\n", N);
+  printf("%10s %14s\n", "pinned", "ns/task");
+  for (long pinned : {0L, 100L, 1000L, 10000L})
+  {
+    printf("%10ld %14.1f\n", pinned, run(pinned));
+  }
+  return 0;
+}
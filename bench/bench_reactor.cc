@@ -0,0 +1,107 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * epoll与io_uring后端的事件吞吐
+ * P个管道，每个管道一个读协程：read非阻塞，没有数据时addEvent(READ)后yield；
+ * 外部线程每一轮向所有管道各写一个字节，等所有读协程都读到之后再开始下一轮
+ * 每个事件在epoll下需要addEvent和触发后各一次epoll_ctl，io_uring下注册都是SQE，和等待一起提交
+ */
+static const int PIPES = 64;
+static const int ROUNDS = 5000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_reads{0};
+
+static void reader(int fd)
+{
+  char buf[64];
+  for (int got = 0; got < ROUNDS;)
+  {
+    int n = read(fd, buf, sizeof(buf));
+    if (n > 0)
+    {
+      got += n;
+      s_reads.fetch_add(n, std::memory_order_relaxed);
+      continue;
+    }
+    IOManager::GetThis()->addEvent(fd, IOManager::READ);
+    Fiber::GetThis()->yield();
+  }
+}
+
+static void run(Reactor::Backend backend, int threads)
+{
+  std::vector<int> rfds(PIPES), wfds(PIPES);
+  for (int i = 0; i < PIPES; ++i)
+  {
+    int fds[2];
+    if (pipe(fds))
+    {
+      perror("pipe");
+      return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    rfds[i] = fds[0];
+    wfds[i] = fds[1];
+  }
+
+  s_reads = 0;
+  double sec = 0;
+  const char *name = "";
+  {
+    IOManager iom(threads, false, "bench", backend);
+    name = iom.getBackendName();
+    for (int i = 0; i < PIPES; ++i)
+    {
+      int fd = rfds[i];
+      iom.scheduleLock([fd]()
+                       { reader(fd); });
+    }
+
+    Clock::time_point start = Clock::now();
+    for (long r = 1; r <= ROUNDS; ++r)
+    {
+      for (int i = 0; i < PIPES; ++i)
+      {
+        if (write(wfds[i], "x", 1) != 1)
+        {
+          perror("write");
+        }
+      }
+      while (s_reads.load(std::memory_order_relaxed) < r * PIPES)
+      {
+        std::this_thread::yield();
+      }
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  printf("  %-10s threads=%d  %8.0f events/s  %6.2f us/event\n", name, threads,
+         PIPES * ROUNDS / sec, sec * 1e6 / (PIPES * ROUNDS));
+  for (int i = 0; i < PIPES; ++i)
+  {
+    close(rfds[i]);
+    close(wfds[i]);
+  }
+}
+
+int main()
+{
+  printf("%d pipes x %d rounds\n", PIPES, ROUNDS);
+  for (int threads : {1, 2})
+  {
+    run(Reactor::EPOLL, threads);
+    run(Reactor::IO_URING, threads);
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * 调度吞吐随线程数的变化
+ * spawn:  若干个根任务在工作线程里递归派生子任务（二叉树），任务都在工作线程内产生
+ * inject: 主线程一次性提交全部任务，都经过注入队列
+ * 每个任务只做很少的计算，测的主要是入队出队本身的开销
+ * 用法：bench_scaling [最大线程数]，默认为CPU核数（至少4）
+ */
+static const int ROOTS = 16;
+static const int DEPTH = 12; // 每个根任务派生 2^(DEPTH+1)-1 个任务
+static const long TOTAL = ROOTS * ((2L << DEPTH) - 1);
+
+static std::atomic<long> s_done{0};
+
+static void work()
+{
+  volatile int x = 0;
+  for (int i = 0; i < 100; ++i)
+  {
+    x += i;
+  }
+  s_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void spawnTask(int depth)
+{
+  if (depth > 0)
+  {
+    Scheduler *sc = Scheduler::GetThis();
+    sc->scheduleLock([depth]()
+                     { spawnTask(depth - 1); });
+    sc->scheduleLock([depth]()
+                     { spawnTask(depth - 1); });
+  }
+  work();
+}
+
+static void wait(long target)
+{
+  while (s_done.load() < target)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+// 返回每秒完成的任务数（百万）
+static double run(int threads, bool inject)
+{
+  IOManager iom(threads, false, "bench");
+  s_done = 0;
+  auto start = std::chrono::steady_clock::now();
+  if (inject)
+  {
+    for (long i = 0; i < TOTAL; ++i)
+    {
+      iom.scheduleLock(work);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < ROOTS; ++i)
+    {
+      iom.scheduleLock([]()
+                       { spawnTask(DEPTH); });
+    }
+  }
+  wait(TOTAL);
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return TOTAL / sec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  int max_threads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+  if (max_threads < 4)
+  {
+    max_threads = 4;
+  }
+
+  printf("%ld tasks, cpus = %u\n", TOTAL, std::thread::hardware_concurrency());
+  printf("%8s %14s %14s\n", "threads", "spawn Mtask/s", "inject Mtask/s");
+  for (int n = 1; n <= max_threads; n *= 2)
+  {
+    double spawn = run(n, false);
+    double inject = run(n, true);
+    printf("%8d %14.2f %14.2f\n", n, spawn, inject);
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include "../src/fiber/fiber.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 共享栈与独立栈的对比
+ * 1. 内存：N个协程各用掉约2KB栈后挂起，统计VSZ/RSS增量和共享栈保存的平均大小
+ * 2. 切换：两个协程交替恢复（共享栈每次都要换出换入），以及单个协程反复恢复（无需拷贝）
+ */
+static const int PARKED = 10000;
+static const long SWITCHES = 1000000;
+
+static bool s_done = false;
+
+static void parkedFunc()
+{
+  volatile char frame[2048];
+  memset((char *)frame, 1, sizeof(frame));
+  while (!s_done)
+  {
+    Fiber::GetThis()->yield();
+  }
+}
+
+static void statm(long &vsz_kb, long &rss_kb)
+{
+  long vsz = 0, rss = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f)
+  {
+    if (fscanf(f, "%ld %ld", &vsz, &rss) != 2)
+    {
+      vsz = rss = 0;
+    }
+    fclose(f);
+  }
+  long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  vsz_kb = vsz * page_kb;
+  rss_kb = rss * page_kb;
+}
+
+static void benchMemory(bool shared)
+{
+  long vsz0, rss0, vsz1, rss1;
+  statm(vsz0, rss0);
+
+  s_done = false;
+  std::vector<std::shared_ptr<Fiber>> fibers;
+  fibers.reserve(PARKED);
+  for (int i = 0; i < PARKED; ++i)
+  {
+    fibers.push_back(std::make_shared<Fiber>(parkedFunc, 0, false, shared));
+    fibers.back()->resume();
+  }
+  statm(vsz1, rss1);
+
+  size_t saved = 0;
+  for (auto &f : fibers)
+  {
+    saved += f->getSavedStackSize();
+  }
+
+  printf("%-8s parked=%d  vsz +%ld KB (%.1f KB/fiber)  rss +%ld KB (%.2f KB/fiber)  saved stack avg %zu B\n",
+         shared ? "shared" : "private", PARKED,
+         vsz1 - vsz0, (double)(vsz1 - vsz0) / PARKED,
+         rss1 - rss0, (double)(rss1 - rss0) / PARKED,
+         saved / PARKED);
+
+  s_done = true;
+  for (auto &f : fibers)
+  {
+    f->resume();
+  }
+}
+
+static double benchSwitch(bool shared, int fiber_count)
+{
+  s_done = false;
+  std::vector<std::shared_ptr<Fiber>> fibers;
+  for (int i = 0; i < fiber_count; ++i)
+  {
+    fibers.push_back(std::make_shared<Fiber>(parkedFunc, 0, false, shared));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < SWITCHES; ++i)
+  {
+    fibers[i % fiber_count]->resume();
+  }
+  auto cost = std::chrono::steady_clock::now() - start;
+
+  s_done = true;
+  for (auto &f : fibers)
+  {
+    f->resume();
+  }
+  return std::chrono::duration<double, std::nano>(cost).count() / SWITCHES;
+}
+
+int main()
+{
+  Fiber::GetThis();
+
+  benchMemory(false);
+  benchMemory(true);
+
+  printf("resume+yield round trip, %ld rounds\n", SWITCHES);
+  printf("  %-34s %8.1f ns\n", "private, 1 fiber", benchSwitch(false, 1));
+  printf("  %-34s %8.1f ns\n", "private, 2 fibers alternating", benchSwitch(false, 2));
+  printf("  %-34s %8.1f ns\n", "shared, 1 fiber (no copy)", benchSwitch(true, 1));
+  printf("  %-34s %8.1f ns\n", "shared, 2 fibers alternating", benchSwitch(true, 2));
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <dlfcn.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 定时器容差：一个外部线程在RUN_MS毫秒内分批匀速添加超时时间错开的定时器（模拟各个请求的超时），
+ * 超时时间是添加时刻之后的随机值；统计每秒的唤醒次数（替换epoll_wait/epoll_pwait2计数）、
+ * 每秒因为插入更早的定时器而tickle的次数，以及定时器实际触发比超时时间晚了多少
+ * 密集：10万个定时器，超时2~50毫秒，每毫秒都有定时器到期；
+ * 稀疏：每2毫秒添加一个，超时1~20毫秒，新的定时器经常早于事件循环正在等待的那个
+ */
+static const int RUN_MS = 2000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_waits{0};
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  typedef int (*epoll_wait_fun)(int, struct epoll_event *, int, int);
+  static epoll_wait_fun real = (epoll_wait_fun)dlsym(RTLD_NEXT, "epoll_wait");
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return real(epfd, events, maxevents, timeout);
+}
+
+extern "C" int epoll_pwait2(int epfd, struct epoll_event *events, int maxevents, const struct timespec *timeout,
+                            const sigset_t *sigmask)
+{
+  typedef int (*epoll_pwait2_fun)(int, struct epoll_event *, int, const struct timespec *, const sigset_t *);
+  static epoll_pwait2_fun real = (epoll_pwait2_fun)dlsym(RTLD_NEXT, "epoll_pwait2");
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return real(epfd, events, maxevents, timeout, sigmask);
+}
+
+// 统计插入更早的定时器引起的tickle
+class CountingIOManager : public IOManager
+{
+public:
+  using IOManager::IOManager;
+  std::atomic<long> tickles{0};
+
+protected:
+  void onTimerInsertedAtFront() override
+  {
+    tickles.fetch_add(1, std::memory_order_relaxed);
+    IOManager::onTimerInsertedAtFront();
+  }
+};
+
+struct Load
+{
+  const char *name;
+  int timers;
+  int batches;
+  int min_ms;
+  int max_ms;
+};
+
+static void run(const Load &load, bool high_res, std::chrono::milliseconds slack)
+{
+  const int TIMERS = load.timers;
+  std::vector<Clock::time_point> due(TIMERS);
+  std::vector<double> late(TIMERS);
+  std::atomic<int> fired{0};
+  long waits = 0;
+  double sec = 0;
+  long tickles = 0;
+  {
+    CountingIOManager iom(1, false, "slack");
+    iom.setHighResolutionTimers(high_res);
+    iom.setTimerSlack(slack);
+    std::mt19937 rng(1);
+    long start_waits = s_waits;
+    Clock::time_point start = Clock::now();
+    for (int b = 0; b < load.batches; ++b)
+    {
+      std::this_thread::sleep_until(start + std::chrono::microseconds((long)b * RUN_MS * 1000 / load.batches));
+      for (int i = b * TIMERS / load.batches; i < (b + 1) * TIMERS / load.batches; ++i)
+      {
+        std::chrono::microseconds timeout(load.min_ms * 1000 + rng() % ((load.max_ms - load.min_ms) * 1000));
+        due[i] = Clock::now() + timeout;
+        iom.addTimer(timeout, [i, &due, &late, &fired]()
+                     {
+          late[i] = std::chrono::duration<double, std::micro>(Clock::now() - due[i]).count();
+          fired.fetch_add(1, std::memory_order_relaxed); });
+      }
+    }
+    while (fired < TIMERS)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    waits = s_waits - start_waits;
+    tickles = iom.tickles;
+  }
+  std::sort(late.begin(), late.end());
+  printf("  %-6s  %-9s slack %2ld ms  %6.0f wakeups/s  %6.0f tickles/s   late p50 %6.0f us  p99 %6.0f us\n",
+         load.name, high_res ? "high-res" : "default", (long)slack.count(), waits / sec, tickles / sec, late[TIMERS / 2],
+         late[TIMERS * 99 / 100]);
+}
+
+int main()
+{
+  const Load loads[] = {{"dense", 100000, 400, 2, 50}, {"sparse", 1000, 1000, 1, 20}};
+  for (const Load &load : loads)
+  {
+    printf("%s: %d timers added over %d ms, timeouts %d~%d ms\n", load.name, load.timers, RUN_MS, load.min_ms,
+           load.max_ms);
+    for (bool high_res : {false, true})
+    {
+      for (int slack : {0, 1, 5, 20})
+      {
+        run(load, high_res, std::chrono::milliseconds(slack));
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * 大量协程反复睡眠：FIBERS个协程各自循环调用hook的usleep，统计每次唤醒的平均开销
+ * usleep(0)的定时器在下一轮idle就到期，测的是唤醒路径本身；usleep(100)是短间隔的限速
+ */
+static const int FIBERS = 1000;
+static const int ROUNDS = 200;
+
+using Clock = std::chrono::steady_clock;
+
+static void run(int threads, useconds_t usec)
+{
+  IOManager iom(threads, false, "sleep");
+  std::atomic<int> done{0};
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < FIBERS; ++i)
+  {
+    iom.scheduleLock([&]()
+                     {
+      for (int r = 0; r < ROUNDS; ++r)
+      {
+        usleep(usec);
+      }
+      ++done; });
+  }
+  while (done < FIBERS)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("  threads=%d  usleep(%3u)  %7.0f ns/wakeup  %8.0f wakeups/s\n", threads, usec,
+         sec * 1e9 / ((double)FIBERS * ROUNDS), (double)FIBERS * ROUNDS / sec);
+}
+
+int main()
+{
+  printf("%d fibers x %d sleeps\n", FIBERS, ROUNDS);
+  for (int threads : {1, 2})
+  {
+    run(threads, 0);
+    run(threads, 100);
+  }
+  return 0;
+}
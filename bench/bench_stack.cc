@@ -0,0 +1,103 @@
+#include "../src/fiber/fiber.h"
+#include "../src/fiber/stack_allocator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 协程栈分配开销
+ * 对比malloc(128000)/free与StackAllocator，以及完整的Fiber创建-运行-销毁，
+ * 单线程和多线程各跑一遍，最后输出进程RSS
+ */
+static const long N = 200000;
+static const size_t STACK_SIZE = 128000;
+
+static double nsPerOp(std::chrono::steady_clock::duration d, long n)
+{
+  return std::chrono::duration<double, std::nano>(d).count() / n;
+}
+
+// 栈从高地址开始使用，写一下栈顶所在的页
+static void touchTop(void *stack, size_t size)
+{
+  ((volatile char *)stack)[size - 64] = 1;
+}
+
+static void mallocLoop(long n)
+{
+  for (long i = 0; i < n; ++i)
+  {
+    void *stack = malloc(STACK_SIZE);
+    touchTop(stack, STACK_SIZE);
+    free(stack);
+  }
+}
+
+static void allocatorLoop(long n)
+{
+  for (long i = 0; i < n; ++i)
+  {
+    size_t size = STACK_SIZE;
+    void *stack = StackAllocator::Alloc(size);
+    touchTop(stack, size);
+    StackAllocator::Dealloc(stack, size);
+  }
+}
+
+static void fiberLoop(long n)
+{
+  Fiber::GetThis();
+  for (long i = 0; i < n; ++i)
+  {
+    std::shared_ptr<Fiber> fiber = std::make_shared<Fiber>([]() {}, 0, false);
+    fiber->resume();
+  }
+}
+
+static double run(void (*loop)(long), int threads)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> thrs;
+  for (int i = 0; i < threads; ++i)
+  {
+    thrs.emplace_back(loop, N / threads);
+  }
+  for (auto &t : thrs)
+  {
+    t.join();
+  }
+  return nsPerOp(std::chrono::steady_clock::now() - start, N);
+}
+
+static long rssKB()
+{
+  long pages = 0, rss = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f)
+  {
+    if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+    {
+      rss = 0;
+    }
+    fclose(f);
+  }
+  return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main()
+{
+  printf("%ld ops, stack size %zu\n", N, STACK_SIZE);
+  for (int threads : {1, 4})
+  {
+    printf("threads = %d\n", threads);
+    printf("  %-28s %8.1f ns/op\n", "malloc/free", run(mallocLoop, threads));
+    printf("  %-28s %8.1f ns/op\n", "StackAllocator", run(allocatorLoop, threads));
+    printf("  %-28s %8.1f ns/op\n", "Fiber create/run/destroy", run(fiberLoop, threads));
+  }
+  printf("rss: %ld KB\n", rssKB());
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * IOManager高频调度时唤醒的开销
+ * 外部线程每次scheduleLock BURST个空任务，等它们执行完再发下一批，每次入队都会tickle；
+ * 只有真正有线程在等待、并且上一次唤醒还没被消费时才需要写一次唤醒fd
+ * 唤醒次数用/proc/self/io里的write系统调用数（syscw）统计
+ */
+static const long TASKS = 200000;
+static const int BURST = 8;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_done{0};
+
+static long WriteSyscalls()
+{
+  FILE *f = fopen("/proc/self/io", "r");
+  if (!f)
+  {
+    return -1;
+  }
+  char line[128];
+  long n = -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (strncmp(line, "syscw:", 6) == 0)
+    {
+      n = atol(line + 6);
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+static void run(Reactor::Backend backend, int threads)
+{
+  s_done = 0;
+  double sec = 0;
+  const char *name = "";
+  long writes = 0;
+  {
+    IOManager iom(threads, false, "bench", backend);
+    name = iom.getBackendName();
+    long w0 = WriteSyscalls();
+    Clock::time_point start = Clock::now();
+    for (long i = 0; i < TASKS; i += BURST)
+    {
+      for (int j = 0; j < BURST; ++j)
+      {
+        iom.scheduleLock([]()
+                         { s_done.fetch_add(1, std::memory_order_relaxed); });
+      }
+      while (s_done.load(std::memory_order_relaxed) < i + BURST)
+      {
+        std::this_thread::yield();
+      }
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    writes = WriteSyscalls() - w0;
+  }
+  printf("  %-10s threads=%d  %6.0f ns/task  %7ld wake writes (%.3f/task)\n", name, threads,
+         sec * 1e9 / TASKS, writes, (double)writes / TASKS);
+}
+
+int main()
+{
+  printf("%ld tasks scheduled from outside in bursts of %d\n", TASKS, BURST);
+  for (int threads : {1, 2, 4})
+  {
+    run(Reactor::EPOLL, threads);
+    run(Reactor::IO_URING, threads);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace colib;
+
+/*
+ * 带超时的读：PAIRS对socket上各有两个协程通过hook的read/write来回传一个字节，
+ * 读端设置SO_RCVTIMEO（超时不会真正发生），和不设置超时比较每次往返的时间和内存分配次数
+ * （替换全局operator new计数）
+ */
+static const int PAIRS = 64;
+static const int ROUNDS = 5000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_allocs{0};
+
+void *operator new(size_t size)
+{
+  s_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static void pingPong(int fd, bool first, std::atomic<int> &done)
+{
+  char c = 0;
+  for (int r = 0; r < ROUNDS; ++r)
+  {
+    if (first && write(fd, &c, 1) != 1)
+    {
+      break;
+    }
+    if (read(fd, &c, 1) != 1)
+    {
+      perror("read");
+      break;
+    }
+    if (!first && write(fd, &c, 1) != 1)
+    {
+      break;
+    }
+  }
+  ++done;
+}
+
+static void run(int threads, bool timed)
+{
+  int pairs[PAIRS][2];
+  for (auto &sv : pairs)
+  {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    if (timed)
+    {
+      timeval tv{10, 0};
+      setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+      setsockopt(sv[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    }
+  }
+  std::atomic<int> done{0};
+  long allocs = 0;
+  Clock::time_point start;
+  {
+    IOManager iom(threads, false, "timed_io");
+    start = Clock::now();
+    long start_allocs = s_allocs;
+    for (auto &sv : pairs)
+    {
+      int a = sv[0], b = sv[1];
+      iom.scheduleLock([a, &done]()
+                       { pingPong(a, true, done); });
+      iom.scheduleLock([b, &done]()
+                       { pingPong(b, false, done); });
+    }
+    while (done < PAIRS * 2)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    allocs = s_allocs - start_allocs;
+  }
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+  double trips = (double)PAIRS * ROUNDS;
+  printf("  threads=%d  %-10s  %6.0f ns per round trip  %5.2f allocations per round trip\n", threads,
+         timed ? "SO_RCVTIMEO" : "no timeout", sec * 1e9 / trips, allocs / trips);
+  for (auto &sv : pairs)
+  {
+    close(sv[0]);
+    close(sv[1]);
+  }
+}
+
+int main()
+{
+  printf("%d socket pairs x %d round trips\n", PAIRS, ROUNDS);
+  for (int threads : {1, 2})
+  {
+    run(threads, false);
+    run(threads, true);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include "../src/timer/timer.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 定时器队列：堆（std::set）和分层时间轮
+ * 超时：TIMERS个1~30秒的定时器全部在触发前取消，模拟每个请求一个超时
+ * 刷新：每个定时器refresh一次，模拟连接上有数据时推迟空闲超时
+ * 触发：TIMERS个定时器分布在1秒内，轮询listExpiredCb直到全部触发
+ */
+static const int TIMERS = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+static double since(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void run(TimerManager::Queue queue, const char *name)
+{
+  std::mt19937 rng(42);
+  std::vector<uint64_t> delays(TIMERS);
+  for (auto &d : delays)
+  {
+    d = 1000 + rng() % 29000;
+  }
+
+  TimerManager manager(queue);
+  std::vector<std::shared_ptr<Timer>> timers(TIMERS);
+
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < TIMERS; ++i)
+  {
+    timers[i] = manager.addTimer(delays[i], []() {});
+  }
+  double add = since(start);
+
+  start = Clock::now();
+  for (int i = 0; i < TIMERS; ++i)
+  {
+    timers[i]->refresh();
+  }
+  double refresh = since(start);
+
+  start = Clock::now();
+  for (int i = 0; i < TIMERS; ++i)
+  {
+    timers[i]->cancel();
+  }
+  double cancel = since(start);
+
+  // 触发
+  long fired = 0;
+  for (int i = 0; i < TIMERS; ++i)
+  {
+    timers[i] = manager.addTimer(rng() % 1000, [&fired]()
+                                 { ++fired; });
+  }
+  std::vector<Callback> cbs;
+  double expire = 0;
+  while (fired < TIMERS)
+  {
+    uint64_t next = manager.getNextTimer();
+    if (next)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(next));
+    }
+    start = Clock::now();
+    manager.getNextTimer();
+    manager.listExpiredCb(cbs);
+    for (auto &cb : cbs)
+    {
+      cb();
+    }
+    cbs.clear();
+    expire += since(start);
+  }
+
+  printf("  %-5s  add %6.0f ns  refresh %6.0f ns  cancel %6.0f ns  expire %6.0f ns  (per timer)\n", name,
+         add * 1e9 / TIMERS, refresh * 1e9 / TIMERS, cancel * 1e9 / TIMERS, expire * 1e9 / TIMERS);
+}
+
+int main()
+{
+  printf("%d timers\n", TIMERS);
+  run(TimerManager::HEAP, "heap");
+  run(TimerManager::WHEEL, "wheel");
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * 多线程下的请求超时：每个工作线程上的协程反复添加一个超时定时器再取消（请求在超时前完成），
+ * 每OPS_PER_YIELD次让出一次，让idle循环也计算等待时间；比较共享队列和每个线程的私有队列
+ */
+static const int FIBERS_PER_THREAD = 8;
+static const int OPS = 200000;
+static const int OPS_PER_YIELD = 64;
+
+using Clock = std::chrono::steady_clock;
+
+static void run(int threads, bool per_thread)
+{
+  IOManager iom(threads, false, "timer_mt");
+  iom.setPerThreadTimers(per_thread);
+  int fibers = threads * FIBERS_PER_THREAD;
+  std::atomic<int> done{0};
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < fibers; ++i)
+  {
+    iom.scheduleLock([&]()
+                     {
+      IOManager *self = IOManager::GetThis();
+      for (int k = 0; k < OPS; ++k)
+      {
+        self->addTimer(30000, []() {})->cancel();
+        if (k % OPS_PER_YIELD == 0)
+        {
+          self->scheduleLock(Fiber::GetThis());
+          Fiber::GetThis()->yield();
+        }
+      }
+      ++done; });
+  }
+  while (done < fibers)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double sec = std::chrono::duration<double>(Clock::now() - start).count();
+  double ops = (double)fibers * OPS;
+  printf("  threads=%d  %-10s  %6.0f ns per add+cancel  %6.2f M ops/s\n", threads, per_thread ? "per-thread" : "shared",
+         sec * 1e9 / ops, ops / sec / 1e6);
+}
+
+int main()
+{
+  printf("%d fibers per thread x %d add+cancel\n", FIBERS_PER_THREAD, OPS);
+  for (int threads : {1, 2, 4})
+  {
+    run(threads, false);
+    run(threads, true);
+  }
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include "../src/iomanager/ioscheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+using namespace colib;
+
+/*
+ * 每个连接一个超时：在IO协程调度器的协程中反复设置、取消（或刷新）一个连接的超时
+ * 比较shared_ptr的Timer、条件定时器和嵌入在连接对象中的TimerNode，统计每次操作的时间和内存分配次数
+ * （替换全局operator new计数）
+ */
+static const int CONNS = 10000;
+static const int ROUNDS = 100;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<long> s_allocs{0};
+
+void *operator new(size_t size)
+{
+  s_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Conn
+{
+  std::shared_ptr<Timer> timer;
+  std::shared_ptr<int> alive = std::make_shared<int>(0);
+  TimerNode node;
+  TimerHandle handle;
+};
+
+enum Mode
+{
+  TIMER,
+  CONDITION,
+  NODE,
+  NODE_REFRESH
+};
+
+static void run(Mode mode, const char *name)
+{
+  IOManager iom(1, false, "timer_node");
+  iom.reserveTimerNodes(CONNS);
+  Conn *conns = new Conn[CONNS];
+  std::atomic<bool> done{false};
+  double sec = 0;
+  long allocs = 0;
+  iom.scheduleLock([&]()
+                   {
+    IOManager *self = IOManager::GetThis();
+    for (int i = 0; i < CONNS; ++i)
+    {
+      conns[i].node.setCallback([]() {});
+    }
+    long start_allocs = s_allocs;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+      for (int i = 0; i < CONNS; ++i)
+      {
+        Conn &c = conns[i];
+        switch (mode)
+        {
+        case TIMER:
+          c.timer = self->addTimer(30000, []() {});
+          c.timer->cancel();
+          break;
+        case CONDITION:
+          c.timer = self->addConditionTimer(30000, []() {}, c.alive);
+          c.timer->cancel();
+          break;
+        case NODE:
+          c.handle = self->arm(c.node, std::chrono::seconds(30));
+          self->cancel(c.handle);
+          break;
+        case NODE_REFRESH:
+          // 连接上每来一个请求推迟一次超时
+          if (!self->refresh(c.handle, std::chrono::seconds(30)))
+          {
+            c.handle = self->arm(c.node, std::chrono::seconds(30));
+          }
+          break;
+        }
+      }
+    }
+    sec = std::chrono::duration<double>(Clock::now() - start).count();
+    allocs = s_allocs - start_allocs;
+    for (int i = 0; i < CONNS; ++i)
+    {
+      conns[i].node.cancel();
+      conns[i].timer.reset();
+    }
+    done = true; });
+  while (!done)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double ops = (double)CONNS * ROUNDS;
+  printf("  %-26s %6.0f ns per op  %5.2f allocations per op\n", name, sec * 1e9 / ops, allocs / ops);
+  delete[] conns;
+}
+
+int main()
+{
+  printf("%d connections x %d rounds, 30 s timeout\n", CONNS, ROUNDS);
+  run(TIMER, "addTimer + cancel");
+  run(CONDITION, "addConditionTimer + cancel");
+  run(NODE, "TimerNode arm + cancel");
+  run(NODE_REFRESH, "TimerNode refresh");
+  return 0;
+}
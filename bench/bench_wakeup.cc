@@ -0,0 +1,64 @@
+#include "../src/scheduler/scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 基础调度器的唤醒延迟：工作线程空闲时投递一个任务，统计从scheduleLock到任务开始执行的时间
+ * 每次投递之间间隔一段时间，保证工作线程已经自旋结束进入睡眠（spin=0时直接睡眠），
+ * 另外测一次间隔很短、线程还在自旋时的延迟
+ */
+static const int ROUNDS = 2000;
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> s_ran{false};
+static Clock::time_point s_runAt;
+
+static void report(const char *name, std::vector<double> &us)
+{
+  std::sort(us.begin(), us.end());
+  printf("  %-28s p50 %8.1f us   p99 %8.1f us   max %8.1f us\n", name,
+         us[us.size() / 2], us[us.size() * 99 / 100], us.back());
+}
+
+static void run(const char *name, uint32_t spin, std::chrono::microseconds gap)
+{
+  Scheduler sc(2, false, "bench");
+  sc.setIdleSpinCount(spin);
+  sc.start();
+
+  std::vector<double> us;
+  us.reserve(ROUNDS);
+  for (int i = 0; i < ROUNDS; ++i)
+  {
+    std::this_thread::sleep_for(gap);
+    s_ran = false;
+    Clock::time_point start = Clock::now();
+    sc.scheduleLock([]()
+                    {
+      s_runAt = Clock::now();
+      s_ran.store(true, std::memory_order_release); });
+    while (!s_ran.load(std::memory_order_acquire))
+    {
+      std::this_thread::yield();
+    }
+    us.push_back(std::chrono::duration<double, std::micro>(s_runAt - start).count());
+  }
+  report(name, us);
+  sc.stop();
+}
+
+int main()
+{
+  printf("schedule -> run latency, %d rounds\n", ROUNDS);
+  run("parked (spin=0)", 0, std::chrono::microseconds(500));
+  run("parked (spin=2000)", 2000, std::chrono::microseconds(2000));
+  run("spinning (spin=1000000)", 1000000, std::chrono::microseconds(50));
+  return 0;
+}
@@ -0,0 +1,12 @@
+# 编译基准测试，每个bench_*.cc生成一个可执行文件，输出到bench/bin
+cd `dirname $0`
+mkdir -p bin
+
+SOURCES="../src/thread/thread.cc ../src/fiber/context.cc ../src/fiber/stack_allocator.cc ../src/fiber/fiber.cc \
+         ../src/scheduler/scheduler.cc ../src/timer/timer.cc ../src/timer/timing_wheel.cc ../src/iomanager/reactor.cc ../src/iomanager/uring_reactor.cc ../src/iomanager/ioscheduler.cc \
+         ../src/hook/fd_manager.cc ../src/hook/hook.cc"
+
+for f in ${@:-bench_*.cc}; do
+  echo "building ${f%.cc}"
+  g++ $f $SOURCES -std=c++20 -O2 $CXXFLAGS -o bin/${f%.cc} -ldl -lpthread || exit 1
+done
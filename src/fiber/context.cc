@@ -0,0 +1,175 @@
+#include "context.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+
+#ifndef COLIB_CONTEXT_UCONTEXT
+
+/*
+ * colib_swap_context(void **from, void *to)
+ * 只保存ABI规定的callee-saved寄存器，其余寄存器由调用方负责，
+ * 因此一次切换只是几次压栈、换栈和出栈
+ */
+#if defined(__x86_64__)
+// rdi = from, rsi = to
+// 栈布局(低->高): mxcsr|x87cw, r15, r14, r13, r12, rbx, rbp, 返回地址
+asm(R"(
+  .text
+  .globl colib_swap_context
+  .type colib_swap_context,@function
+  .align 16
+colib_swap_context:
+  pushq %rbp
+  pushq %rbx
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  subq $8, %rsp
+  stmxcsr (%rsp)
+  fnstcw 4(%rsp)
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  ldmxcsr (%rsp)
+  fldcw 4(%rsp)
+  addq $8, %rsp
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %rbx
+  popq %rbp
+  ret
+  .size colib_swap_context,.-colib_swap_context
+)");
+#elif defined(__aarch64__)
+// x0 = from, x1 = to
+// 栈布局(低->高): d8-d15, x19-x28, x29(fp), x30(lr), pc
+asm(R"(
+  .text
+  .globl colib_swap_context
+  .type colib_swap_context,%function
+  .align 4
+colib_swap_context:
+  sub sp, sp, #0xb0
+  stp d8, d9, [sp, #0x00]
+  stp d10, d11, [sp, #0x10]
+  stp d12, d13, [sp, #0x20]
+  stp d14, d15, [sp, #0x30]
+  stp x19, x20, [sp, #0x40]
+  stp x21, x22, [sp, #0x50]
+  stp x23, x24, [sp, #0x60]
+  stp x25, x26, [sp, #0x70]
+  stp x27, x28, [sp, #0x80]
+  stp x29, x30, [sp, #0x90]
+  str x30, [sp, #0xa0]
+  mov x4, sp
+  str x4, [x0]
+  mov sp, x1
+  ldp d8, d9, [sp, #0x00]
+  ldp d10, d11, [sp, #0x10]
+  ldp d12, d13, [sp, #0x20]
+  ldp d14, d15, [sp, #0x30]
+  ldp x19, x20, [sp, #0x40]
+  ldp x21, x22, [sp, #0x50]
+  ldp x23, x24, [sp, #0x60]
+  ldp x25, x26, [sp, #0x70]
+  ldp x27, x28, [sp, #0x80]
+  ldp x29, x30, [sp, #0x90]
+  ldr x4, [sp, #0xa0]
+  add sp, sp, #0xb0
+  ret x4
+  .size colib_swap_context,.-colib_swap_context
+)");
+#endif
+
+#endif
+
+namespace colib
+{
+#ifdef COLIB_CONTEXT_UCONTEXT
+
+  void Context::make(void *stack, size_t size, void (*fn)())
+  {
+    if (getcontext(&m_ctx))
+    {
+      std::cerr << "Context::make() getcontext failed\n";
+      pthread_exit(NULL);
+    }
+
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+  }
+
+  void Context::swapTo(Context &to)
+  {
+    if (swapcontext(&m_ctx, &to.m_ctx))
+    {
+      std::cerr << "Context::swapTo() swapcontext failed\n";
+      pthread_exit(NULL);
+    }
+  }
+
+  void *Context::stackPointer() const
+  {
+#if defined(__x86_64__)
+    return (void *)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void *)m_ctx.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+  }
+
+  const char *Context::BackendName() { return "ucontext"; }
+
+#else
+
+  /*
+   * 伪造一次colib_swap_context的现场：
+   * 第一次切换进来时弹出全0的寄存器，然后"返回"到fn
+   */
+  void Context::make(void *stack, size_t size, void (*fn)())
+  {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    void **sp = (void **)top;
+
+#if defined(__x86_64__)
+    *--sp = nullptr;   // fn的"返回地址"，fn不会返回；同时保证进入fn时rsp % 16 == 8
+    *--sp = (void *)fn; // ret的目标
+    for (int i = 0; i < 6; ++i)
+    {
+      *--sp = nullptr; // rbp, rbx, r12-r15
+    }
+    --sp;
+    uint32_t *csr = (uint32_t *)sp;
+    csr[0] = 0x1F80; // mxcsr默认值
+    csr[1] = 0x037F; // x87控制字默认值
+#elif defined(__aarch64__)
+    sp = (void **)(top - 0xb0);
+    memset(sp, 0, 0xb0);
+    sp[0xa0 / sizeof(void *)] = (void *)fn;
+#endif
+
+    m_sp = sp;
+  }
+
+  void Context::swapTo(Context &to)
+  {
+    colib_swap_context(&m_sp, to.m_sp);
+  }
+
+  void *Context::stackPointer() const { return m_sp; }
+
+#if defined(__x86_64__)
+  const char *Context::BackendName() { return "asm-x86_64"; }
+#else
+  const char *Context::BackendName() { return "asm-aarch64"; }
+#endif
+
+#endif
+}
@@ -0,0 +1,52 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <cstddef>
+
+// 默认在x86-64/AArch64上使用手写汇编切换，其它平台或定义了COLIB_USE_UCONTEXT时退回ucontext
+#if defined(COLIB_USE_UCONTEXT) || !(defined(__x86_64__) || defined(__aarch64__))
+#define COLIB_CONTEXT_UCONTEXT 1
+#include <ucontext.h>
+#endif
+
+#ifndef COLIB_CONTEXT_UCONTEXT
+extern "C"
+{
+  // 保存callee-saved寄存器到当前栈，把栈顶写入*from，然后切换到to指向的栈
+  // 与boost fcontext思路相同：不保存信号掩码，也不进入内核
+  void colib_swap_context(void **from, void *to);
+}
+#endif
+
+namespace colib
+{
+  /*
+   * 协程上下文
+   * 汇编后端只保存一个栈指针，寄存器压在协程自己的栈上；
+   * ucontext后端保存完整的ucontext_t，每次切换都会调用rt_sigprocmask
+   */
+  class Context
+  {
+  public:
+    // 在[stack, stack + size)上构造一个入口为fn的上下文，fn不能返回
+    void make(void *stack, size_t size, void (*fn)());
+
+    // 保存当前执行状态到this，切换到to
+    void swapTo(Context &to);
+
+    // 挂起时的栈顶，共享栈模式按它计算需要保存的栈大小，未知时返回nullptr
+    void *stackPointer() const;
+
+    // 当前编译的后端名称
+    static const char *BackendName();
+
+  private:
+#ifdef COLIB_CONTEXT_UCONTEXT
+    ucontext_t m_ctx;
+#else
+    void *m_sp = nullptr;
+#endif
+  };
+}
+
+#endif
@@ -1,4 +1,8 @@
 #include "fiber.h"
+#include "stack_allocator.h"
+#include "../thread/thread.h"
+
+#include <cstring>
 
 static bool debug = false;
 
@@ -17,6 +21,50 @@ namespace colib
   static std::atomic<uint64_t> s_fiber_id{0};
   static std::atomic<uint64_t> s_fiber_count{0};
 
+  /*
+   * 共享栈
+   * 同一线程上的共享栈协程都运行在这块栈上，同一时刻只有一个占用者。
+   * 换入别的协程之前，把占用者用到的部分（挂起时的栈顶到栈底）拷贝到它自己的缓冲区，
+   * 拷贝都发生在调度协程/主协程的独立栈上
+   */
+  struct SharedStack
+  {
+    void *stack = nullptr;
+    size_t size = 0;
+    int thread = -1;                     // 所属线程
+    std::atomic<Fiber *> occupant{nullptr}; // 当前栈上保存着谁的内容
+    std::mutex mutex;                    // 换出占用者时加锁，占用者可能正在其它线程析构
+
+    explicit SharedStack(size_t sz) : size(sz)
+    {
+      stack = StackAllocator::Alloc(size);
+      thread = Thread::GetThreadID();
+    }
+
+    ~SharedStack()
+    {
+      StackAllocator::Dealloc(stack, size);
+    }
+  };
+
+  static size_t s_shared_stack_size = 1024 * 1024;
+  static thread_local std::shared_ptr<SharedStack> t_shared_stack = nullptr;
+
+  void Fiber::SetSharedStackSize(size_t size)
+  {
+    s_shared_stack_size = size;
+  }
+
+  bool Fiber::OnSharedStack(const void *p)
+  {
+    if (!t_shared_stack)
+    {
+      return false;
+    }
+    const char *base = (const char *)t_shared_stack->stack;
+    return (const char *)p >= base && (const char *)p < base + t_shared_stack->size;
+  }
+
   void Fiber::SetThis(Fiber *f)
   {
     t_fiber = f;
@@ -68,10 +116,7 @@ namespace colib
     SetThis(this);
     m_state = RUNNING;
 
-    if(getcontext(&m_ctx)){
-      std::cerr << "Fiber() failed\n";
-      pthread_exit(NULL);
-    }
+    // 主协程运行在线程自己的栈上，上下文在第一次切出时保存
 
     m_id = s_fiber_id++;
     s_fiber_count++;
@@ -84,27 +129,22 @@ namespace colib
    * 分配栈空间，默认128kb
    * 初始化协程上下文，设置栈和入口函数
   */
-  Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
-      : m_cb(cb), m_runInScheduler(run_in_scheduler)
+  Fiber::Fiber(Callback cb, size_t stacksize, bool run_in_scheduler, bool shared_stack)
+      : m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler), m_useSharedStack(shared_stack)
   {
     m_state = READY;
 
-    // 栈大小默认128k
-    m_stacksize = stacksize ? stacksize : 128000;
-    m_stack = malloc(m_stacksize);
-
-    if (getcontext(&m_ctx))
+    // 共享栈模式在第一次resume时才在共享栈上建立上下文，避免破坏当前占用者的栈
+    if (!m_useSharedStack)
     {
-      std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
-      pthread_exit(NULL);
-    }
+      // 栈大小默认128k，从栈分配器按档位取，m_stacksize为实际可用大小
+      size_t size = stacksize ? stacksize : 128000;
+      m_stack = StackAllocator::Alloc(size);
+      m_stacksize = size;
 
-    // 初始化下文：
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+      // 初始化上下文：设置栈和入口函数
+      m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+    }
 
     m_id = s_fiber_id;
     s_fiber_count++;
@@ -116,29 +156,39 @@ namespace colib
     s_fiber_count--;
     if (m_stack)
     {
-      free(m_stack);
+      StackAllocator::Dealloc(m_stack, m_stacksize);
     }
+    if (m_sharedStack)
+    {
+      std::lock_guard<std::mutex> lock(m_sharedStack->mutex);
+      if (m_sharedStack->occupant == this)
+      {
+        m_sharedStack->occupant = nullptr;
+      }
+    }
+    free(m_saveBuffer);
     if (debug)
       std::cout << "~Fiber(): id = " << m_id << std::endl;
   }
 
   // 结束的协程可以重置
-  void Fiber::reset(std::function<void()> cb)
+  void Fiber::reset(Callback cb)
   {
-    assert(m_stack != nullptr && m_state == TERM);
+    assert((m_stack != nullptr || m_useSharedStack) && m_state == TERM);
 
     m_state = READY;
-    m_cb = cb;
+    m_cb = std::move(cb);
 
-    if(getcontext(&m_ctx)){
-      std::cerr << "reset() failed\n";
-      pthread_exit(NULL);
+    if (m_useSharedStack)
+    {
+      // 结束的协程栈上没有需要保留的内容，解除与线程的绑定
+      m_started = false;
+      m_saveSize = 0;
+      m_thread = -1;
+      m_sharedStack.reset();
+      return;
     }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
   }
 
   /*
@@ -149,25 +199,99 @@ namespace colib
   void Fiber::resume()
   {
     assert(m_state == READY);
+    if (m_useSharedStack)
+    {
+      switchInSharedStack();
+    }
     m_state = RUNNING;
 
     if (m_runInScheduler) {
       SetThis(this);
-      if (swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))
-      {
-        std::cerr << "resume() to t_scheduler_fiber failed\n";
-        pthread_exit(NULL);
-      }
+      t_scheduler_fiber->m_ctx.swapTo(m_ctx);
     } else {
       SetThis(this);
-      if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+      t_thread_fiber->m_ctx.swapTo(m_ctx);
+    }
+
+    // 结束的协程不再占用共享栈
+    if (m_useSharedStack && m_state == TERM)
+    {
+      std::lock_guard<std::mutex> lock(m_sharedStack->mutex);
+      m_sharedStack->occupant = nullptr;
+      m_saveSize = 0;
+    }
+  }
+
+  /*
+   * 共享栈的换入
+   * 在调用方（调度协程或主协程）的独立栈上执行，
+   * 第一次运行时绑定到当前线程的共享栈
+   */
+  void Fiber::switchInSharedStack()
+  {
+    assert(!t_fiber || !t_fiber->m_useSharedStack);
+    if (!m_sharedStack)
+    {
+      if (!t_shared_stack)
+      {
+        t_shared_stack = std::make_shared<SharedStack>(s_shared_stack_size);
+      }
+      m_sharedStack = t_shared_stack;
+      m_thread = m_sharedStack->thread;
+    }
+    // 栈里保存的是绝对地址，只能在绑定的线程上恢复
+    assert(m_sharedStack == t_shared_stack);
+
+    SharedStack *ss = m_sharedStack.get();
+    if (ss->occupant.load(std::memory_order_relaxed) == this)
+    {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(ss->mutex);
+      Fiber *occupant = ss->occupant;
+      if (occupant)
       {
-        std::cerr << "resume() to t_thread_fiber failed\n";
-        pthread_exit(NULL);
+        occupant->saveStack();
       }
+      ss->occupant = this;
+    }
+
+    if (!m_started)
+    {
+      m_ctx.make(ss->stack, ss->size, &Fiber::MainFunc);
+      m_started = true;
+    }
+    else
+    {
+      memcpy((char *)ss->stack + ss->size - m_saveSize, m_saveBuffer, m_saveSize);
+      m_saveSize = 0;
     }
   }
 
+  // 把挂起时用到的栈拷贝出来，缓冲区按实际大小分配
+  void Fiber::saveStack()
+  {
+    char *top = (char *)m_sharedStack->stack + m_sharedStack->size;
+    char *sp = (char *)m_ctx.stackPointer();
+    if (!sp)
+    {
+      // 后端拿不到栈顶，只能整块保存
+      sp = (char *)m_sharedStack->stack;
+    }
+
+    size_t used = top - sp;
+    if (m_saveCapacity < used || m_saveCapacity > used * 2)
+    {
+      free(m_saveBuffer);
+      m_saveBuffer = malloc(used);
+      m_saveCapacity = used;
+    }
+    memcpy(m_saveBuffer, sp, used);
+    m_saveSize = used;
+  }
+
   /*
    * 协程的让出
    * yield 将协程从 RUNNING 切换回 READY（或 TERM），
@@ -183,18 +307,10 @@ namespace colib
 
     if (m_runInScheduler) {
       SetThis(t_scheduler_fiber);
-      if (swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx)))
-      {
-        std::cerr << "yield() to to t_scheduler_fiber failed\n";
-        pthread_exit(NULL);
-      }
+      m_ctx.swapTo(t_scheduler_fiber->m_ctx);
     } else {
       SetThis(t_thread_fiber.get());
-      if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
-      {
-        std::cerr << "yield() to t_thread_fiber failed\n";
-        pthread_exit(NULL);
-      }
+      m_ctx.swapTo(t_thread_fiber->m_ctx);
     }
   }
 
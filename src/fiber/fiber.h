@@ -6,12 +6,15 @@
 #include <atomic>
 #include <functional>
 #include <cassert>
-#include <ucontext.h>
 #include <unistd.h>
 #include <mutex>
+#include "context.h"
+#include "../util/callback.h"
 
 namespace colib
 {
+  struct SharedStack;
+
   class Fiber : public std::enable_shared_from_this<Fiber>
   {
   public:
@@ -28,12 +31,14 @@ namespace colib
 
   public:
   // 创建用户协程
-    Fiber(std::function<void()> cb,
-          size_t stacksize = 0, bool run_in_scheduler = true);
+  // shared_stack为true时运行在线程的共享栈上，切换时只拷贝用到的部分，stacksize被忽略
+    Fiber(Callback cb,
+          size_t stacksize = 0, bool run_in_scheduler = true,
+          bool shared_stack = false);
     ~Fiber();
     
     // 重置协程状态和入口函数，复用栈空间，不重新创建栈
-    void reset(std::function<void()> cb);
+    void reset(Callback cb);
 
     void resume(); // 恢复协程运行
     void yield();  // 让出执行
@@ -41,6 +46,12 @@ namespace colib
     // 获取协程ID，协程状态
     uint64_t getId() const { return m_id; }
     State getState() const { return m_state; }
+
+    // 共享栈协程第一次运行后绑定到所在线程，只能在该线程恢复；其它协程返回-1
+    int getThread() const { return m_thread; }
+    bool isSharedStack() const { return m_useSharedStack; }
+    // 共享栈协程被换出时保存的栈大小
+    size_t getSavedStackSize() const { return m_saveSize; }
   
   public:
     // 设置正在运行的协程
@@ -54,19 +65,37 @@ namespace colib
     static uint64_t GetFiberId();
     // 协程入口函数
     static void MainFunc();
+    // 每个线程共享栈的大小，默认1M，在线程第一次运行共享栈协程之前设置才生效
+    static void SetSharedStackSize(size_t size);
+    // 地址是否在当前线程的共享栈上；这样的内存在协程换出后会被其它协程覆盖，不能交给别人长期引用
+    static bool OnSharedStack(const void *p);
+
+  private:
+    // 共享栈：把占用者的栈换出，再换入自己的栈
+    void switchInSharedStack();
+    void saveStack();
 
   private:
     uint64_t m_id = 0;
     State m_state = READY;
 
-    ucontext_t m_ctx;
+    Context m_ctx; // 上下文，后端见context.h
 
     uint32_t m_stacksize = 0;    // 栈大小
     void *m_stack = nullptr;    // 栈空间
 
-    std::function<void()> m_cb; // 运行函数
+    Callback m_cb; // 运行函数
     bool m_runInScheduler; // 是否参与协程调度器
 
+    // 共享栈模式
+    bool m_useSharedStack = false;
+    bool m_started = false;                      // 上下文是否已经建立在共享栈上
+    int m_thread = -1;                           // 绑定的线程
+    std::shared_ptr<SharedStack> m_sharedStack;  // 运行所在的共享栈
+    void *m_saveBuffer = nullptr;                // 换出时保存的栈内容
+    size_t m_saveSize = 0;
+    size_t m_saveCapacity = 0;
+
     public:
       std::mutex m_mutex;
   };
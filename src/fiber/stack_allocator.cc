@@ -0,0 +1,212 @@
+#include "stack_allocator.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+
+namespace colib
+{
+  // 线程缓存和全局池之间一次交换的栈数量
+  static const size_t BATCH_SIZE = StackAllocator::THREAD_CACHE_SIZE / 2;
+
+  static size_t PageSize()
+  {
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+  }
+
+  // 档位下标，超过最大档位返回CLASS_COUNT
+  static size_t SizeClass(size_t size)
+  {
+    size_t cls = 0;
+    size_t class_size = StackAllocator::MIN_STACK_SIZE;
+    while (class_size < size && cls < StackAllocator::CLASS_COUNT)
+    {
+      class_size <<= 1;
+      ++cls;
+    }
+    return cls;
+  }
+
+  static size_t ClassSize(size_t cls)
+  {
+    return StackAllocator::MIN_STACK_SIZE << cls;
+  }
+
+  static void *MapStack(size_t size)
+  {
+    size_t guard = PageSize();
+    void *base = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+      std::cerr << "StackAllocator mmap failed, size = " << size << std::endl;
+      pthread_exit(NULL);
+    }
+    // 栈向低地址增长，保护页放在最低处
+    if (mprotect(base, guard, PROT_NONE))
+    {
+      std::cerr << "StackAllocator mprotect failed" << std::endl;
+    }
+    return (char *)base + guard;
+  }
+
+  static void UnmapStack(void *stack, size_t size)
+  {
+    size_t guard = PageSize();
+    munmap((char *)stack - guard, size + guard);
+  }
+
+  /* 全局池，线程缓存溢出或者不足时使用 */
+  struct GlobalPool
+  {
+    std::mutex mutex;
+    std::vector<void *> stacks[StackAllocator::CLASS_COUNT];
+  };
+
+  static GlobalPool &GetGlobalPool()
+  {
+    // 不析构，保证其它线程退出时仍然可以归还
+    static GlobalPool *pool = new GlobalPool();
+    return *pool;
+  }
+
+  /* 线程缓存 */
+  struct ThreadCache
+  {
+    std::vector<void *> stacks[StackAllocator::CLASS_COUNT];
+
+    ThreadCache()
+    {
+      for (auto &v : stacks)
+      {
+        v.reserve(StackAllocator::THREAD_CACHE_SIZE);
+      }
+    }
+
+    // 线程退出时把缓存的栈交还给全局池
+    ~ThreadCache();
+  };
+
+  // 线程缓存析构之后（线程退出过程中）仍可能有协程被释放，此时直接走全局池
+  static thread_local bool t_cache_destroyed = false;
+  static thread_local ThreadCache *t_cache = nullptr;
+
+  static void PushGlobal(size_t cls, void **stacks, size_t n)
+  {
+    GlobalPool &pool = GetGlobalPool();
+    size_t i = 0;
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      for (; i < n && pool.stacks[cls].size() < StackAllocator::GLOBAL_POOL_SIZE; ++i)
+      {
+        pool.stacks[cls].push_back(stacks[i]);
+      }
+    }
+    // 全局池也满了，归还给系统
+    for (; i < n; ++i)
+    {
+      UnmapStack(stacks[i], ClassSize(cls));
+    }
+  }
+
+  ThreadCache::~ThreadCache()
+  {
+    for (size_t cls = 0; cls < StackAllocator::CLASS_COUNT; ++cls)
+    {
+      PushGlobal(cls, stacks[cls].data(), stacks[cls].size());
+      stacks[cls].clear();
+    }
+    t_cache = nullptr;
+    t_cache_destroyed = true;
+  }
+
+  static ThreadCache *GetThreadCache()
+  {
+    if (!t_cache && !t_cache_destroyed)
+    {
+      static thread_local ThreadCache cache;
+      t_cache = &cache;
+    }
+    return t_cache;
+  }
+
+  void *StackAllocator::Alloc(size_t &size)
+  {
+    size_t cls = SizeClass(size);
+    if (cls == CLASS_COUNT)
+    {
+      // 超大栈不缓存
+      size = (size + PageSize() - 1) / PageSize() * PageSize();
+      return MapStack(size);
+    }
+
+    size = ClassSize(cls);
+    ThreadCache *cache = GetThreadCache();
+    if (!cache)
+    {
+      return MapStack(size);
+    }
+
+    std::vector<void *> &local = cache->stacks[cls];
+    if (local.empty())
+    {
+      // 从全局池批量取一些
+      GlobalPool &pool = GetGlobalPool();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      std::vector<void *> &global = pool.stacks[cls];
+      while (!global.empty() && local.size() < BATCH_SIZE)
+      {
+        local.push_back(global.back());
+        global.pop_back();
+      }
+    }
+
+    if (local.empty())
+    {
+      return MapStack(size);
+    }
+    void *stack = local.back();
+    local.pop_back();
+    return stack;
+  }
+
+  void StackAllocator::Dealloc(void *stack, size_t size)
+  {
+    if (!stack)
+    {
+      return;
+    }
+
+    size_t cls = SizeClass(size);
+    if (cls == CLASS_COUNT || ClassSize(cls) != size)
+    {
+      UnmapStack(stack, size);
+      return;
+    }
+
+    ThreadCache *cache = GetThreadCache();
+    if (!cache)
+    {
+      PushGlobal(cls, &stack, 1);
+      return;
+    }
+
+    std::vector<void *> &local = cache->stacks[cls];
+    if (local.size() >= THREAD_CACHE_SIZE)
+    {
+      // 缓存满了，把一半交给全局池
+      PushGlobal(cls, local.data() + local.size() - BATCH_SIZE, BATCH_SIZE);
+      local.resize(local.size() - BATCH_SIZE);
+    }
+    local.push_back(stack);
+  }
+
+  size_t StackAllocator::GuardSize()
+  {
+    return PageSize();
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef STACK_ALLOCATOR_H
+#define STACK_ALLOCATOR_H
+
+#include <cstddef>
+
+namespace colib
+{
+  /*
+   * 协程栈分配器
+   * 栈由mmap分配，低地址处留一页PROT_NONE作为保护页，栈溢出时直接段错误而不是踩坏别的内存。
+   * 按大小分档（64K, 128K, ... 8M），每个线程为每一档缓存若干空闲栈，
+   * 缓存满了或空了再批量与全局池交换，因此协程的创建销毁通常不需要加锁也不需要系统调用。
+   * 超过最大档位的栈直接mmap/munmap。
+   */
+  class StackAllocator
+  {
+  public:
+    // 分配至少size字节的栈，size返回实际可用大小，返回值为栈的低地址（保护页之上）
+    static void *Alloc(size_t &size);
+    // 归还Alloc得到的栈，size为Alloc返回的可用大小
+    static void Dealloc(void *stack, size_t size);
+
+    // 保护页大小，即系统页大小
+    static size_t GuardSize();
+
+  public:
+    static const size_t MIN_STACK_SIZE = 64 * 1024; // 最小档位
+    static const size_t CLASS_COUNT = 8;            // 档位数量，最大档位为MIN_STACK_SIZE << 7
+    static const size_t THREAD_CACHE_SIZE = 16;     // 每个线程每一档最多缓存的栈
+    static const size_t GLOBAL_POOL_SIZE = 256;     // 全局池每一档最多缓存的栈
+  };
+}
+
+#endif
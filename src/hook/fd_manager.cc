@@ -3,4 +3,130 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <unistd.h>
\ No newline at end of file
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace colib{
+  // 第一次见到fd时检查一次，之后的hook不再做系统调用
+  bool FdCtx::init(int fd){
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1){
+      // fd无效
+      return false;
+    }
+    m_isSocket = S_ISSOCK(statbuf.st_mode);
+    m_userNonblock = false;
+    m_sysNonblock = false;
+    m_flags = -1;
+    m_recvTimeout = (uint64_t)-1;
+    m_sendTimeout = (uint64_t)-1;
+
+    if(m_isSocket){
+      // 在这之前已经是非阻塞的，只能是用户自己设置的
+      int flags = fcntl_f(fd, F_GETFL, 0);
+      if(flags & O_NONBLOCK){
+        m_userNonblock = true;
+      }else{
+        fcntl_f(fd, F_SETFL, flags | O_NONBLOCK);
+      }
+      m_sysNonblock = true;
+      m_flags = flags | O_NONBLOCK;
+
+      // 用户可能在hook接管之前已经设置过超时
+      struct timeval tv;
+      socklen_t len = sizeof(tv);
+      if (getsockopt_f(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) == 0){
+        m_recvTimeout = TimeoutMs(tv);
+      }
+      len = sizeof(tv);
+      if (getsockopt_f(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, &len) == 0){
+        m_sendTimeout = TimeoutMs(tv);
+      }
+    }
+
+    publish();
+    return true;
+  }
+
+  // 新创建的socket没有设置过超时，非阻塞在创建时已经由SOCK_NONBLOCK设置
+  void FdCtx::initSocket(int flags, bool user_nonblock){
+    m_isSocket = true;
+    m_userNonblock = user_nonblock;
+    m_sysNonblock = true;
+    m_flags = flags;
+    m_recvTimeout = (uint64_t)-1;
+    m_sendTimeout = (uint64_t)-1;
+    publish();
+  }
+
+  // 字段写完之后再发布，无锁读取的一方看到READY时字段一定已经可见
+  void FdCtx::publish(){
+    m_generation.fetch_add(1, std::memory_order_relaxed);
+    m_state.store(READY, std::memory_order_release);
+  }
+
+  void FdCtx::setTimeout(int type, uint64_t v){
+    if(type == SO_RCVTIMEO){
+      m_recvTimeout.store(v, std::memory_order_relaxed);
+    }else{
+      m_sendTimeout.store(v, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t FdCtx::getTimeout(int type) const{
+    if(type == SO_RCVTIMEO){
+      return m_recvTimeout.load(std::memory_order_relaxed);
+    }else{
+      return m_sendTimeout.load(std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t FdCtx::TimeoutMs(const timeval &tv){
+    // 负数和内核一样当作不超时
+    if(tv.tv_sec < 0 || (tv.tv_sec == 0 && tv.tv_usec <= 0)){
+      return (uint64_t)-1;
+    }
+    return (uint64_t)tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+  }
+
+  FdCtx *FdManager::get(int fd, bool auto_create){
+    FdCtx *ctx = auto_create ? m_datas.getOrCreate(fd, [](FdCtx &, int) {}) : m_datas.get(fd);
+    if(!ctx){
+      return nullptr;
+    }
+    // 快速路径：已经初始化
+    if(ctx->isInit()){
+      return ctx;
+    }
+    if(!auto_create){
+      return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(ctx->m_mutex);
+    if(ctx->isInit()){
+      return ctx;
+    }
+    return ctx->init(fd) ? ctx : nullptr;
+  }
+
+  FdCtx *FdManager::addSocket(int fd, int flags, bool user_nonblock){
+    FdCtx *ctx = m_datas.getOrCreate(fd, [](FdCtx &, int) {});
+    if(!ctx){
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(ctx->m_mutex);
+    ctx->initSocket(flags, user_nonblock);
+    return ctx;
+  }
+
+  void FdManager::del(int fd){
+    FdCtx *ctx = m_datas.get(fd);
+    if(!ctx){
+      return;
+    }
+    std::lock_guard<std::mutex> lock(ctx->m_mutex);
+    if(ctx->m_state.load(std::memory_order_relaxed) == FdCtx::READY){
+      ctx->m_state.store(FdCtx::CLOSED, std::memory_order_release);
+    }
+  }
+}
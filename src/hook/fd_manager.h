@@ -1,8 +1,104 @@
 #ifndef FD_MANAGER_H
 #define FD_MANAGER_H
 
-#include <memory>
-#include <shared_mutex>
-#include "../thread/thread.h"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <sys/time.h>
+#include "../util/fd_table.h"
 
-#endif
\ No newline at end of file
+namespace colib{
+  /* fd上下文
+  * hook需要知道fd是不是socket、用户有没有自己设置非阻塞、收发超时是多少
+  * socket由hook设置成系统层面的非阻塞，用户看到的仍然是阻塞语义
+  * 上下文存放在FdManager的表里，fd关闭后原地复用，地址不会失效；
+  * fd号码每被复用一次代数加一，等待中的协程据此发现fd已经不是原来那个
+  */
+  class FdCtx
+  {
+  public:
+    bool isInit() const { return m_state.load(std::memory_order_acquire) == READY; }
+    bool isSocket() const { return m_isSocket.load(std::memory_order_relaxed); }
+    bool isClosed() const { return m_state.load(std::memory_order_acquire) == CLOSED; }
+    uint32_t getGeneration() const { return m_generation.load(std::memory_order_acquire); }
+
+    void setUserNonblock(bool v) { m_userNonblock.store(v, std::memory_order_relaxed); }
+    bool getUserNonblock() const { return m_userNonblock.load(std::memory_order_relaxed); }
+
+    void setSysNonblock(bool v) { m_sysNonblock.store(v, std::memory_order_relaxed); }
+    bool getSysNonblock() const { return m_sysNonblock.load(std::memory_order_relaxed); }
+
+    // 内核中的文件状态标志（F_GETFL的结果），-1表示未知，需要真正的系统调用
+    void setFlags(int v) { m_flags.store(v, std::memory_order_relaxed); }
+    int getFlags() const { return m_flags.load(std::memory_order_relaxed); }
+
+    // type为SO_RCVTIMEO或者SO_SNDTIMEO，单位毫秒，-1表示不超时
+    void setTimeout(int type, uint64_t v);
+    uint64_t getTimeout(int type) const;
+    // SO_RCVTIMEO/SO_SNDTIMEO的值换算成毫秒：0表示不超时，不足1毫秒的向上取整，不会变成不超时
+    static uint64_t TimeoutMs(const timeval &tv);
+
+  private:
+    friend class FdManager;
+
+    enum State
+    {
+      EMPTY,  // 从未使用
+      READY,  // 已经初始化
+      CLOSED  // 已经关闭，号码复用时重新初始化
+    };
+
+    // 第一次见到的fd，通过fstat/fcntl/getsockopt检查
+    bool init(int fd);
+    // 由hook自己创建的非阻塞socket，不需要任何系统调用
+    void initSocket(int flags, bool user_nonblock);
+    void publish();
+
+    std::mutex m_mutex; // 只在初始化和关闭时使用
+    std::atomic<int> m_state = {EMPTY};
+    std::atomic<uint32_t> m_generation = {0};
+    std::atomic<bool> m_isSocket = {false};
+    std::atomic<bool> m_sysNonblock = {false};  // hook设置的系统非阻塞
+    std::atomic<bool> m_userNonblock = {false}; // 用户设置的非阻塞，此时hook不介入
+    std::atomic<int> m_flags = {-1};
+
+    std::atomic<uint64_t> m_recvTimeout = {(uint64_t)-1};
+    std::atomic<uint64_t> m_sendTimeout = {(uint64_t)-1};
+  };
+
+  /* fd上下文表
+  * 以fd为下标的FdTable，查找无等待：没有锁，也不增减引用计数
+  * 只有第一次见到某个fd号码、或者号码关闭后被复用时才加这个上下文自己的锁
+  */
+  class FdManager
+  {
+  public:
+    // auto_create为true时不存在就创建；fd无效或者已经关闭并且不创建时返回nullptr
+    FdCtx *get(int fd, bool auto_create = false);
+    // 记录hook刚创建的socket，flags为创建时内核中的状态标志（已经包含O_NONBLOCK）
+    FdCtx *addSocket(int fd, int flags, bool user_nonblock);
+    // 标记关闭，上下文留在表里等待号码复用
+    void del(int fd);
+
+  private:
+    FdTable<FdCtx> m_datas;
+  };
+
+  template <typename T>
+  class Singleton
+  {
+  public:
+    static T *GetInstance()
+    {
+      static T instance;
+      return &instance;
+    }
+
+  private:
+    Singleton() = delete;
+  };
+
+  typedef Singleton<FdManager> FdMgr;
+}
+
+#endif
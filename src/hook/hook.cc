@@ -52,13 +52,91 @@ namespace colib{
 }
 
 /* global */
-struct timer_info{
-  int cancelled = 0;
-};
+// connect的默认超时，-1表示不超时
+static uint64_t s_connect_timeout = -1;
 
+// F_SETFL能修改的文件状态标志，其余位（访问模式、创建标志）保持不变
+static const int SETFL_MASK = O_APPEND | O_ASYNC | O_DIRECT | O_NOATIME | O_NONBLOCK;
+
+/* 所有socket读写hook的公共流程
+* 先直接做一次系统调用，EAGAIN时在IO协程调度器上注册事件并让出，就绪后回来重试
+* 设置了SO_RCVTIMEO/SO_SNDTIMEO时注册带超时的事件，事件循环到期时取消事件，返回ETIMEDOUT
+* 不是socket、用户自己设置了非阻塞或者不在IO协程调度器中时不介入
+*/
 template<typename OriginFun,typename... Args>
 static ssize_t do_io(int fd,OriginFun fun,const char* hook_fun_name,uint32_t event,int timeout_so,Args&&... args){
+  if(!colib::t_hook_enable){
+    return fun(fd, std::forward<Args>(args)...);
+  }
+
+  // 第一次见到的fd检查一次类型，之后直接使用缓存，不加锁也不做系统调用
+  colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd, true);
+  if(!ctx){
+    return fun(fd, std::forward<Args>(args)...);
+  }
+  colib::IOManager *iom = colib::IOManager::GetThis();
+  if(!ctx->isSocket() || ctx->getUserNonblock() || !iom){
+    return fun(fd, std::forward<Args>(args)...);
+  }
+
+  uint64_t timeout = ctx->getTimeout(timeout_so);
+  uint32_t generation = ctx->getGeneration();
+
+retry:
+  ssize_t n = fun(fd, std::forward<Args>(args)...);
+  // 被信号中断，重试
+  while(n == -1 && errno == EINTR){
+    n = fun(fd, std::forward<Args>(args)...);
+  }
+
+  if(n == -1 && errno == EAGAIN){
+    colib::IOManager::Clock::time_point deadline = colib::IOManager::Clock::time_point::max();
+    if(timeout != (uint64_t)-1){
+      deadline = iom->now() + std::chrono::milliseconds(timeout);
+    }
 
+    int rt = iom->addEvent(fd, (colib::IOManager::Event)event, nullptr, deadline);
+    if(rt){
+      std::cerr << hook_fun_name << " addEvent(" << fd << ", " << event << ") failed" << std::endl;
+      return -1;
+    }
+
+    colib::Fiber::GetThis()->yield();
+    // 超时的结果由事件循环记录在fd context中，协程被唤醒之后读取
+    if(int status = iom->takeEventStatus(fd, (colib::IOManager::Event)event)){
+      errno = status;
+      return -1;
+    }
+    // 等待期间fd被其它协程关闭，号码可能已经被复用
+    if(ctx->isClosed() || ctx->getGeneration() != generation){
+      errno = EBADF;
+      return -1;
+    }
+    goto retry;
+  }
+  return n;
+}
+
+namespace colib{
+  void sleep_for(std::chrono::nanoseconds duration){
+    IOManager *iom = IOManager::GetThis();
+    if(!t_hook_enable || !iom){
+      if(duration.count() <= 0){
+        return;
+      }
+      timespec req;
+      req.tv_sec = duration.count() / 1000000000;
+      req.tv_nsec = duration.count() % 1000000000;
+      while(nanosleep_f(&req, &req) == -1 && errno == EINTR){
+      }
+      return;
+    }
+
+    std::shared_ptr<Fiber> fiber = Fiber::GetThis();
+    // 定时器到期后事件循环直接把当前协程放回任务队列
+    iom->addFiberTimer(duration, fiber);
+    fiber->yield();
+  }
 }
 
 /* extern C */
@@ -78,11 +156,7 @@ extern "C"
       return sleep_f(seconds);
     }
 
-    std::shared_ptr<colib::Fiber> fiber = colib::Fiber::GetThis();
-    colib::IOManager* iom=colib::IOManager::GetThis();
-    iom->addTimer(seconds * 1000, [fiber, iom]()
-                  { iom->scheduleLock(fiber, -1); });
-    fiber->yield();
+    colib::sleep_for(std::chrono::seconds(seconds));
     return 0;
   }
   int usleep(useconds_t usec){
@@ -91,13 +165,8 @@ extern "C"
       return usleep_f(usec);
     }
 
-    std::shared_ptr<colib::Fiber> fiber = colib::Fiber::GetThis();
-    colib::IOManager *iom = colib::IOManager::GetThis();
-    // add a timer to reschedule this fiber
-    iom->addTimer(usec / 1000, [fiber, iom]()
-                  { iom->scheduleLock(fiber); });
-    // wait for the next resume
-    fiber->yield();
+    // 不再换算成毫秒，亚毫秒的睡眠不会变成0超时
+    colib::sleep_for(std::chrono::microseconds(usec));
     return 0;
   }
   int nanosleep(const struct timespec *req, struct timespec *rem){
@@ -106,84 +175,318 @@ extern "C"
       return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
-
-    std::shared_ptr<colib::Fiber> fiber = colib::Fiber::GetThis();
-    colib::IOManager *iom = colib::IOManager::GetThis();
-    // add a timer to reschedule this fiber
-    iom->addTimer(timeout_ms, [fiber, iom]()
-                  { iom->scheduleLock(fiber, -1); });
-    // wait for the next resume
-    fiber->yield();
+    if(req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000){
+      errno = EINVAL;
+      return -1;
+    }
+    colib::sleep_for(std::chrono::seconds(req->tv_sec) + std::chrono::nanoseconds(req->tv_nsec));
     return 0;
   }
 
   /* socket function */
   int socket(int domain, int type, int protocol){
+    if(!colib::t_hook_enable){
+      return socket_f(domain, type, protocol);
+    }
 
+    // 创建时直接设置非阻塞，不需要再fstat/fcntl
+    int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
+    if(fd == -1){
+      return fd;
+    }
+    colib::FdMgr::GetInstance()->addSocket(fd, O_RDWR | O_NONBLOCK, type & SOCK_NONBLOCK);
+    return fd;
   }
-  int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen){
 
+  int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms){
+    if(!colib::t_hook_enable){
+      return connect_f(fd, addr, addrlen);
+    }
+
+    colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd, true);
+    if(!ctx){
+      errno = EBADF;
+      return -1;
+    }
+    colib::IOManager *iom = colib::IOManager::GetThis();
+    if(!ctx->isSocket() || ctx->getUserNonblock() || !iom){
+      return connect_f(fd, addr, addrlen);
+    }
+
+    // 非阻塞connect，没有立即完成时等待可写
+    int n = connect_f(fd, addr, addrlen);
+    if(n == 0){
+      return 0;
+    }else if(n != -1 || errno != EINPROGRESS){
+      return n;
+    }
+
+    uint32_t generation = ctx->getGeneration();
+    colib::IOManager::Clock::time_point deadline = colib::IOManager::Clock::time_point::max();
+    if(timeout_ms != (uint64_t)-1){
+      deadline = iom->now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    int rt = iom->addEvent(fd, colib::IOManager::WRITE, nullptr, deadline);
+    if(rt == 0){
+      colib::Fiber::GetThis()->yield();
+      if(int status = iom->takeEventStatus(fd, colib::IOManager::WRITE)){
+        errno = status;
+        return -1;
+      }
+      if(ctx->isClosed() || ctx->getGeneration() != generation){
+        errno = EBADF;
+        return -1;
+      }
+    }else{
+      std::cerr << "connect addEvent(" << fd << ", WRITE) failed" << std::endl;
+    }
+
+    // 连接的结果
+    int error = 0;
+    socklen_t len = sizeof(int);
+    if(getsockopt_f(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1){
+      return -1;
+    }
+    if(!error){
+      return 0;
+    }
+    errno = error;
+    return -1;
   }
-  int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen){
 
+  int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen){
+    return connect_with_timeout(sockfd, addr, addrlen, s_connect_timeout);
+  }
+
+  // 新连接用accept4直接设置非阻塞，和socket一样不需要额外的系统调用
+  int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen){
+    if(!colib::t_hook_enable){
+      return accept_f(sockfd, addr, addrlen);
+    }
+    int fd = do_io(sockfd, [](int s, struct sockaddr *a, socklen_t *l)
+                   { return accept4(s, a, l, SOCK_NONBLOCK); },
+                   "accept", colib::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if(fd >= 0){
+      colib::FdMgr::GetInstance()->addSocket(fd, O_RDWR | O_NONBLOCK, false);
+    }
+    return fd;
   }
 
   /* read */
   ssize_t read(int fd, void *buf, size_t count){
-
+    return do_io(fd, read_f, "read", colib::IOManager::READ, SO_RCVTIMEO, buf, count);
   }
   ssize_t readv(int fd, const struct iovec *iov, int iovcnt){
-
+    return do_io(fd, readv_f, "readv", colib::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
   }
 
   ssize_t recv(int sockfd, void *buf, size_t len, int flags){
-
+    return do_io(sockfd, recv_f, "recv", colib::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
   } // 从sockfd接收数据
   ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                    struct sockaddr *src_addr, socklen_t *addrlen){
-    
+    return do_io(sockfd, recvfrom_f, "recvfrom", colib::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
   } // 从sockfd接收数据，获取发送者地址，常用于UDP
   ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags){
-
+    return do_io(sockfd, recvmsg_f, "recvmsg", colib::IOManager::READ, SO_RCVTIMEO, msg, flags);
   } // 接收多个消息或者带有复杂头部的消息，比如ICMP
 
   /* write */
   ssize_t write(int fd, const void *buf, size_t count){
-
+    return do_io(fd, write_f, "write", colib::IOManager::WRITE, SO_SNDTIMEO, buf, count);
   }
   ssize_t writev(int fd, const struct iovec *iov, int iovcnt){
-
+    return do_io(fd, writev_f, "writev", colib::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
   }
 
   ssize_t send(int sockfd, const void *buf, size_t len, int flags){
-
+    return do_io(sockfd, send_f, "send", colib::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
   }
   ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                  const struct sockaddr *dest_addr, socklen_t addrlen){
-
+    return do_io(sockfd, sendto_f, "sendto", colib::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
   } // 常用于UDP
   ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags){
-
+    return do_io(sockfd, sendmsg_f, "sendmsg", colib::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
   } // 可用于ICMP
 
   /* fd */
+  // 等待在fd上的协程被唤醒，fd上下文删除，号码被复用时重新检查
   int close(int fd){
-
+    if(colib::FdMgr::GetInstance()->get(fd)){
+      // 先标记关闭，被cancelAll唤醒的协程不会再在这个fd上重新注册
+      colib::FdMgr::GetInstance()->del(fd);
+      colib::IOManager *iom = colib::t_hook_enable ? colib::IOManager::GetThis() : nullptr;
+      if(iom){
+        iom->cancelAll(fd);
+      }
+    }
+    return close_f(fd);
   }
 
   // socket control
+  // 用户设置的非阻塞只记录下来，系统层面保持hook需要的非阻塞；读取时返回用户设置的状态
   int fcntl(int fd, int cmd, ... /*arg*/){
-
+    va_list va;
+    va_start(va, cmd);
+    switch(cmd){
+      case F_SETFL:
+        {
+          int arg = va_arg(va, int);
+          va_end(va);
+          colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd);
+          if(!ctx || !ctx->isSocket()){
+            return fcntl_f(fd, cmd, arg);
+          }
+          ctx->setUserNonblock(arg & O_NONBLOCK);
+          if(ctx->getSysNonblock()){
+            arg |= O_NONBLOCK;
+          }else{
+            arg &= ~O_NONBLOCK;
+          }
+          // 内核中的标志不会变化时（最常见的是用户设置非阻塞）不做系统调用
+          int flags = ctx->getFlags();
+          int new_flags = (flags & ~SETFL_MASK) | (arg & SETFL_MASK);
+          if(flags != -1 && new_flags == flags){
+            return 0;
+          }
+          int rt = fcntl_f(fd, cmd, arg);
+          ctx->setFlags(rt == 0 && flags != -1 ? new_flags : -1);
+          return rt;
+        }
+        break;
+
+      case F_GETFL:
+        {
+          va_end(va);
+          colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd);
+          if(!ctx || !ctx->isSocket()){
+            return fcntl_f(fd, cmd);
+          }
+          // socket的标志只会通过hook修改，直接使用缓存
+          int arg = ctx->getFlags();
+          if(arg == -1){
+            arg = fcntl_f(fd, cmd);
+            if(arg == -1){
+              return arg;
+            }
+            ctx->setFlags(arg);
+          }
+          if(ctx->getUserNonblock()){
+            return arg | O_NONBLOCK;
+          }else{
+            return arg & ~O_NONBLOCK;
+          }
+        }
+        break;
+
+      // 整数参数
+      case F_DUPFD:
+      case F_DUPFD_CLOEXEC:
+      case F_SETFD:
+      case F_SETOWN:
+      case F_SETSIG:
+      case F_SETLEASE:
+      case F_NOTIFY:
+#ifdef F_SETPIPE_SZ
+      case F_SETPIPE_SZ:
+#endif
+        {
+          int arg = va_arg(va, int);
+          va_end(va);
+          return fcntl_f(fd, cmd, arg);
+        }
+        break;
+
+      // 没有参数
+      case F_GETFD:
+      case F_GETOWN:
+      case F_GETSIG:
+      case F_GETLEASE:
+#ifdef F_GETPIPE_SZ
+      case F_GETPIPE_SZ:
+#endif
+        {
+          va_end(va);
+          return fcntl_f(fd, cmd);
+        }
+        break;
+
+      // 指针参数
+      case F_SETLK:
+      case F_SETLKW:
+      case F_GETLK:
+        {
+          struct flock *arg = va_arg(va, struct flock *);
+          va_end(va);
+          return fcntl_f(fd, cmd, arg);
+        }
+        break;
+
+      case F_GETOWN_EX:
+      case F_SETOWN_EX:
+        {
+          struct f_owner_ex *arg = va_arg(va, struct f_owner_ex *);
+          va_end(va);
+          return fcntl_f(fd, cmd, arg);
+        }
+        break;
+
+      default:
+        {
+          void *arg = va_arg(va, void *);
+          va_end(va);
+          return fcntl_f(fd, cmd, arg);
+        }
+        break;
+    }
   } // 操作文件描述符的各种属性
-  int ioctl(int fd, unsigned long request, ...){
 
+  int ioctl(int fd, unsigned long request, ...){
+    va_list va;
+    va_start(va, request);
+    void *arg = va_arg(va, void *);
+    va_end(va);
+
+    // FIONBIO和fcntl设置O_NONBLOCK等价，只记录用户的设置
+    if(request == FIONBIO && arg){
+      bool user_nonblock = !!*(int *)arg;
+      colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd);
+      if(ctx && ctx->isSocket()){
+        ctx->setUserNonblock(user_nonblock);
+        // 系统层面已经是hook需要的状态，不需要系统调用
+        if(ctx->getSysNonblock()){
+          return 0;
+        }
+        // hook没有接管的socket按用户的设置修改，缓存的标志失效
+        ctx->setFlags(-1);
+      }
+    }else if(request == FIOASYNC){
+      // 修改了O_ASYNC，缓存的标志失效
+      colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(fd);
+      if(ctx){
+        ctx->setFlags(-1);
+      }
+    }
+    return ioctl_f(fd, request, arg);
   } // 控制设备或者套接字
 
   int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen){
-
+    return getsockopt_f(sockfd, level, optname, optval, optlen);
   } // 获取套接字的选项值
-  int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen){
 
+  // 收发超时记录在fd上下文中，由do_io的定时器实现
+  int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen){
+    int rt = setsockopt_f(sockfd, level, optname, optval, optlen);
+    // 内核检查过的值才记录，optval/optlen不合法时不会读取
+    if(rt == 0 && level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) &&
+       optval && optlen >= sizeof(timeval)){
+      colib::FdCtx *ctx = colib::FdMgr::GetInstance()->get(sockfd);
+      if(ctx){
+        ctx->setTimeout(optname, colib::FdCtx::TimeoutMs(*(const timeval *)optval));
+      }
+    }
+    return rt;
   }
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <chrono>
 
 /*hook是对系统调用API进行一次封装，将其封装成一个与原始的系统调用API同名的接口
   在应用这个接口时，会先执行封装中的操作，再执行原始的系统调用API。
@@ -32,6 +34,10 @@ namespace colib{
   // hook模块是线程粒度的，各个线程可以单独启用或者关闭hook
   bool is_hook_enable();
   void set_hook_enable(bool flag);
+
+  // 纳秒精度的睡眠，hook的sleep/usleep/nanosleep都由它实现
+  // 启用hook时只让出当前协程，精度取决于IOManager是否开启了高精度定时器；否则阻塞当前线程
+  void sleep_for(std::chrono::nanoseconds duration);
 }
 
 extern "C"{
@@ -110,6 +116,7 @@ extern "C"{
   // socket function
   int socket(int domain, int type, int protocol);
   int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+  int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout_ms); // timeout_ms为-1不超时
   int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 
   // read
@@ -1,54 +1,56 @@
 #include "ioscheduler.h"
+#include "../hook/hook.h"
 
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/prctl.h>
 #include <fcntl.h>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
 
 static bool debug = false;
 
+// 持久注册时关注的事件
+static const uint32_t PERSISTENT_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+// 忙轮询预算的统计窗口
+static const uint64_t BUSY_POLL_WINDOW_US = 100000;
+
+static uint64_t NowUs(){
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 namespace colib{
   /* 构造函数和析构函数 */
-  IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-  :Scheduler(threads,use_caller,name){
-    // 创建epoll fd
-    m_epfd = epoll_create(5000);
-    assert(m_epfd > 0);
-
-    // 创建pipe,半双工，只能从写端流向读端
-    int rt = pipe(m_tickleFds);
-    assert(!rt);
-
-    // 注册pipe句柄的可读事件，tickle调度协程
-    epoll_event event;
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    // 非阻塞，配合ET,管道中没有数据read时会返回不会阻塞
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    assert(!rt);
-    // 加入epoll，可读时会通过epoll wait返回
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    assert(!rt);
-
-    contextResize(32);
+  IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, Reactor::Backend backend,
+                       bool sharded, TimerManager::Queue timer_queue)
+  :Scheduler(threads,use_caller,name), TimerManager(timer_queue), m_sharded(sharded){
+    size_t shards = sharded ? getWorkerCount() : 1;
+    for (size_t i = 0; i < shards; ++i){
+      m_shards.emplace_back(new Shard());
+      // 共享模式下所有线程等待同一个后端，每个线程有自己的唤醒通道
+      m_shards[i]->reactor = Reactor::Create(backend, sharded ? 1 : getWorkerCount());
+      m_shards[i]->index = i;
+    }
+    if (debug)
+      std::cout << "IOManager uses " << getBackendName() << " x " << shards << std::endl;
+    // 分片模式下定时器也属于添加它的线程，不共用一个定时器队列
+    if (sharded){
+      setPerThreadTimers(true);
+    }
 
     start(); // 开启调度器scheduler
   }
 
-  // 调度完所有任务之后，关闭epoll和pipe句柄，释放所有的fd context
+  // 调度完所有任务之后，关闭多路复用后端，释放所有的fd context
   // 退出前，所有的IO事件都要完成调度
   IOManager::~IOManager(){
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    // caller线程参与过调度，回到普通代码之前关闭hook
+    set_hook_enable(false);
 
-    for (size_t i = 0; i < m_fdContexts.size();++i){
-      if(m_fdContexts[i]){
-        delete m_fdContexts[i];
-      }
-    }
+    m_shards.clear();
   }
 
   /* fdcontext */
@@ -67,15 +69,83 @@ namespace colib{
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    if (ctx.deadline != INT64_MAX){
+      std::lock_guard<std::mutex> lock(shard->deadlineMutex);
+      shard->eraseDeadline(ctx.heapIndex);
+      ctx.deadline = INT64_MAX;
+    }
   }
 
-  void IOManager::FdContext::triggerEvent(Event event){
+  /* 超时堆 */
+  void IOManager::Shard::place(size_t i, const Deadline &d){
+    deadlines[i] = d;
+    d.ctx->getEventContext(d.event).heapIndex = (uint32_t)i;
+  }
+
+  void IOManager::Shard::siftUp(size_t i){
+    Deadline d = deadlines[i];
+    while (i > 0){
+      size_t parent = (i - 1) / 2;
+      if (deadlines[parent].deadline <= d.deadline){
+        break;
+      }
+      place(i, deadlines[parent]);
+      i = parent;
+    }
+    place(i, d);
+  }
+
+  void IOManager::Shard::siftDown(size_t i){
+    Deadline d = deadlines[i];
+    size_t n = deadlines.size();
+    while (true){
+      size_t child = 2 * i + 1;
+      if (child >= n){
+        break;
+      }
+      if (child + 1 < n && deadlines[child + 1].deadline < deadlines[child].deadline){
+        ++child;
+      }
+      if (d.deadline <= deadlines[child].deadline){
+        break;
+      }
+      place(i, deadlines[child]);
+      i = child;
+    }
+    place(i, d);
+  }
+
+  void IOManager::Shard::pushDeadline(FdContext *ctx, Event event, int64_t deadline){
+    deadlines.push_back(Deadline{deadline, ctx, event});
+    siftUp(deadlines.size() - 1);
+    deadlineCount.store(deadlines.size());
+  }
+
+  // 用最后一项填补空位
+  void IOManager::Shard::eraseDeadline(size_t i){
+    Deadline last = deadlines.back();
+    deadlines.pop_back();
+    if (i < deadlines.size()){
+      place(i, last);
+      siftUp(i);
+      siftDown(last.ctx->getEventContext(last.event).heapIndex);
+    }
+    deadlineCount.store(deadlines.size());
+  }
+
+  void IOManager::FdContext::triggerEvent(Event event, ReadyList *ready){
     assert(events & event);
     // delete
     events = (Event)(events & ~event);
     // trigger
     EventContext &ctx = getEventContext(event);
-    if (ctx.cb){
+    if (ready && ctx.scheduler == Scheduler::GetThis()){
+      if (ctx.cb){
+        ready->cbs.push_back(std::move(ctx.cb));
+      }else{
+        ready->fibers.push_back(std::move(ctx.fiber));
+      }
+    }else if (ctx.cb){
       ctx.scheduler->scheduleLock(&ctx.cb);
     }else{
       ctx.scheduler->scheduleLock(&ctx.fiber);
@@ -86,22 +156,17 @@ namespace colib{
   }
 
   /* public */
+  int IOManager::addEvent(int fd, Event event, Callback cb){
+    return addEvent(fd, event, std::move(cb), Clock::time_point::max());
+  }
+
   // 添加事件
-  int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
+  int IOManager::addEvent(int fd, Event event, Callback cb, Clock::time_point deadline){
     // 找到fd所在的fdcontext，不存在则分配一个
-    FdContext *fd_ctx = nullptr;
-
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-   // std::shared_lock read_lock(m_mutex); 表达相似，可以互换
-
-    if ((int)m_fdContexts.size() > fd){
-      fd_ctx = m_fdContexts[fd];
-      read_lock.unlock();
-    }else{
-     // read_lock.unlock();
-      std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-      contextResize(fd * 1.5);
-      fd_ctx = m_fdContexts[fd];
+    Shard &shard = shardFor(fd);
+    FdContext *fd_ctx = getFdContext(shard, fd, true);
+    if (!fd_ctx){
+      return -1;
     }
 
     // 这个事件存在时
@@ -109,20 +174,39 @@ namespace colib{
     if(fd_ctx->events & event){
       return -1;
     }
+    fd_ctx->getEventContext(event).status = 0;
 
-    // 添加新的事件,将新的事件加入epoll,用epollevent的私有指针指向fd context
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    // 不是socket时失败，只尝试一次
+    if (m_soBusyPollUs && !fd_ctx->busyPoll){
+      fd_ctx->busyPoll = true;
+      setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &m_soBusyPollUs, sizeof(m_soBusyPollUs));
+    }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt){
-      std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+    if (m_persistent || fd_ctx->persistent){
+      // 第一次使用时注册，之后一直有效
+      if (!fd_ctx->persistent){
+        if (!shard.reactor->update(fd, fd_ctx, fd_ctx->events, PERSISTENT_EVENTS)){
+          return -1;
+        }
+        fd_ctx->persistent = true;
+      }
+      // 事件已经就绪过，直接调度；协程固定在当前线程，yield之后才会被执行
+      if (fd_ctx->ready & event){
+        fd_ctx->ready &= ~event;
+        if (cb){
+          scheduleLock(&cb);
+        }else{
+          scheduleLock(Fiber::GetThis(), getWorkerIndex() >= 0 ? Thread::GetThreadID() : -1);
+        }
+        return 0;
+      }
+    }
+    // 添加新的事件,私有指针指向fd context
+    else if (!shard.reactor->update(fd, fd_ctx, fd_ctx->events, fd_ctx->events | event)){
       return -1;
     }
 
-    ++m_pendingEventCount;
+    ++shard.pendingEventCount;
 
     // 更新fd context, event context
     fd_ctx->events = (Event)(fd_ctx->events | event);
@@ -135,43 +219,97 @@ namespace colib{
       event_ctx.fiber = Fiber::GetThis();
       assert(event_ctx.fiber->getState() == Fiber::RUNNING);
     }
+
+    if (deadline != Clock::time_point::max()){
+      event_ctx.deadline = deadline.time_since_epoch().count();
+      int64_t latest = event_ctx.deadline + getTimerSlack().count();
+      bool wake = false;
+      {
+        // 先加入超时堆再读取等待时间，和idle先公布等待时间再读取超时数配对
+        std::lock_guard<std::mutex> deadline_lock(shard.deadlineMutex);
+        shard.pushDeadline(fd_ctx, event, event_ctx.deadline);
+        wake = latest < shard.armed.load();
+      }
+      // 分片模式下本线程回到事件循环时会重新计算等待时间
+      if (wake){
+        if (!m_sharded){
+          tickle();
+        }else if (getWorkerIndex() != (int)shard.index){
+          tickleThread(getWorkerThread(shard.index));
+        }
+      }
+    }
     return 0;
   }
 
-  // 删除事件
+  // 分片模式下fd可能由其它线程注册，先找当前线程的分片，再找其它分片
   bool IOManager::delEvent(int fd, Event event){
-    // find fd context
-    FdContext *fd_ctx = nullptr;
+    Shard &own = shardFor(fd);
+    if (delEvent(own, fd, event)){
+      return true;
+    }
+    for (auto &shard : m_shards){
+      if (shard.get() != &own && delEvent(*shard, fd, event)){
+        return true;
+      }
+    }
+    return false;
+  }
 
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if((int)m_fdContexts.size() > fd){
-      fd_ctx = m_fdContexts[fd];
-      read_lock.unlock();
-    }else{
-      read_lock.unlock();
+  bool IOManager::cancelEvent(int fd, Event event){
+    Shard &own = shardFor(fd);
+    if (cancelEvent(own, fd, event)){
+      return true;
+    }
+    for (auto &shard : m_shards){
+      if (shard.get() != &own && cancelEvent(*shard, fd, event)){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int IOManager::takeEventStatus(int fd, Event event){
+    FdContext *fd_ctx = getFdContext(shardFor(fd), fd, false);
+    if (!fd_ctx){
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+    FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+    int status = event_ctx.status;
+    event_ctx.status = 0;
+    return status;
+  }
+
+  bool IOManager::cancelAll(int fd){
+    bool found = false;
+    for (auto &shard : m_shards){
+      found = cancelAll(*shard, fd) || found;
+    }
+    return found;
+  }
+
+  // 删除事件
+  bool IOManager::delEvent(Shard &shard, int fd, Event event){
+    // find fd context
+    FdContext *fd_ctx = getFdContext(shard, fd, false);
+    if (!fd_ctx){
       return false;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     // attention 考虑事件不存在
-    if(!(fd_ctx->events)&event){
+    if(!(fd_ctx->events & event)){
       return false;
     }
 
-    // 删除事件
+    // 删除事件，持久注册不需要修改后端
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt){
-      std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
-      return -1;
+    if (!fd_ctx->persistent && !shard.reactor->update(fd, fd_ctx, fd_ctx->events, new_events)){
+      return false;
     }
 
-    --m_pendingEventCount;
+    --shard.pendingEventCount;
 
     // 重置上下文
     fd_ctx->events = new_events;
@@ -181,92 +319,73 @@ namespace colib{
   }
 
   // 取消事件
-  bool IOManager::cancelEvent(int fd, Event event){
+  bool IOManager::cancelEvent(Shard &shard, int fd, Event event){
     // find fd context
-    FdContext *fd_ctx = nullptr;
-
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd)
-    {
-      fd_ctx = m_fdContexts[fd];
-      read_lock.unlock();
-    }
-    else
-    {
-      read_lock.unlock();
+    FdContext *fd_ctx = getFdContext(shard, fd, false);
+    if (!fd_ctx){
       return false;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     // attention 考虑事件不存在
-    if (!(fd_ctx->events) & event)
+    if (!(fd_ctx->events & event))
     {
       return false;
     }
 
     // 删除事件
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt){
-      std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
-      return -1;
+    if (!fd_ctx->persistent && !shard.reactor->update(fd, fd_ctx, fd_ctx->events, new_events)){
+      return false;
     }
 
-    --m_pendingEventCount;
+    --shard.pendingEventCount;
 
     // update fdcontext, event context and trigger
     fd_ctx->triggerEvent(event);
     return true;
   }
 
-  bool IOManager::cancelAll(int fd){
+  bool IOManager::cancelAll(Shard &shard, int fd){
     // attemp to find FdContext
-    FdContext *fd_ctx = nullptr;
-
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd){
-      fd_ctx = m_fdContexts[fd];
-      read_lock.unlock();
-    }else{
-      read_lock.unlock();
+    FdContext *fd_ctx = getFdContext(shard, fd, false);
+    if (!fd_ctx){
       return false;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
+    // 持久注册在这里移除，fd关闭之后号码被复用时重新注册
+    if (fd_ctx->persistent){
+      shard.reactor->update(fd, fd_ctx, PERSISTENT_EVENTS, NONE);
+      fd_ctx->persistent = false;
+      fd_ctx->ready = NONE;
+      fd_ctx->busyPoll = false;
+    }
     // none of events exist
-    if (!fd_ctx->events){
+    else if (!fd_ctx->events){
       return false;
     }
-
     // delete all events
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt){
-      std::cerr << "IOManager::epoll_ctl failed: " << strerror(errno) << std::endl;
-      return -1;
+    else if (!shard.reactor->update(fd, fd_ctx, fd_ctx->events, NONE)){
+      return false;
+    }
+
+    if (!fd_ctx->events){
+      return false;
     }
 
     // update fdcontext, event context and trigger
     if (fd_ctx->events & READ)
     {
       fd_ctx->triggerEvent(READ);
-      --m_pendingEventCount;
+      --shard.pendingEventCount;
     }
 
     if (fd_ctx->events & WRITE)
     {
       fd_ctx->triggerEvent(WRITE);
-      --m_pendingEventCount;
+      --shard.pendingEventCount;
     }
 
     assert(fd_ctx->events == 0);
@@ -277,21 +396,114 @@ namespace colib{
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
   }
 
+  bool IOManager::listenPerWorker(const sockaddr *addr, socklen_t addrlen, int backlog,
+                                  std::function<void(int)> cb){
+    std::vector<int> fds;
+    for (size_t i = 0; i < getWorkerCount(); ++i){
+      int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      int yes = 1;
+      if (fd < 0 ||
+          setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) ||
+          setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) ||
+          bind(fd, addr, addrlen) || listen(fd, backlog)){
+        std::cerr << "IOManager::listenPerWorker failed: " << strerror(errno) << std::endl;
+        if (fd >= 0){
+          close(fd);
+        }
+        for (int opened : fds){
+          close(opened);
+        }
+        return false;
+      }
+      fds.push_back(fd);
+    }
+
+    for (size_t i = 0; i < fds.size(); ++i){
+      int fd = fds[i];
+      scheduleLock([cb, fd]()
+                   { cb(fd); }, getWorkerThread(i));
+    }
+    return true;
+  }
+
   /* protected */
   // 通知调度器有任务调度
+  // 没有线程在等待或者已经有一个唤醒在路上时不做系统调用
+  void IOManager::setBusyPoll(uint32_t spin_us, uint32_t cpu_percent, int so_busy_poll_us){
+    m_busyPollUs = spin_us;
+    m_busyPollBudgetUs = BUSY_POLL_WINDOW_US * cpu_percent / 100;
+    m_soBusyPollUs = so_busy_poll_us;
+  }
+
+  // 返回收割到的事件数；没有预算或者到时间仍然没有事件和任务时返回-1，由调用者阻塞等待
+  // 下一个定时器比spin_us更早到期时只轮询到定时器到期
+  int IOManager::busyPoll(Shard &shard, Reactor::ReadyEvent *events, int max_events, uint64_t timeout_ns){
+    if (!m_busyPollUs){
+      return -1;
+    }
+    uint64_t start = NowUs();
+    uint64_t window = start / BUSY_POLL_WINDOW_US;
+    uint64_t current = m_busyPollWindow.load(std::memory_order_relaxed);
+    if (current != window && m_busyPollWindow.compare_exchange_strong(current, window)){
+      m_busyPollSpentUs = 0;
+    }
+    if (m_busyPollSpentUs.load(std::memory_order_relaxed) >= m_busyPollBudgetUs){
+      return -1;
+    }
+
+    uint64_t deadline = start + std::min<uint64_t>(m_busyPollUs, timeout_ns / 1000);
+    uint64_t now = start;
+    int rt = -1;
+    while (now < deadline){
+      int n = shard.reactor->poll(events, max_events);
+      if (n > 0 || hasReadyTask()){
+        rt = n;
+        break;
+      }
+      now = NowUs();
+    }
+    m_busyPollSpentUs.fetch_add(NowUs() - start, std::memory_order_relaxed);
+    return rt;
+  }
+
+  // 分片模式下从下一个线程开始找一个正在等待的分片
   void IOManager::tickle(){
-    if(!hasIdleThreads()){
+    if (!m_sharded){
+      m_shards[0]->reactor->wake();
       return;
     }
-    // 唤醒，通知管道可读取
-    int rt = write(m_tickleFds[1], "T", 1);
-    assert(rt == 1);
+    size_t n = m_shards.size();
+    size_t start = getWorkerIndex() + 1;
+    for (size_t i = 0; i < n; ++i){
+      if (m_shards[(start + i) % n]->reactor->wake()){
+        return;
+      }
+    }
+  }
+
+  // 只叫醒目标线程，它没有在等待时会在睡眠前检查自己的信箱
+  void IOManager::tickleThread(int thread){
+    int index = getWorkerIndex(thread);
+    if (index < 0){
+      tickle();
+    }else if (m_sharded){
+      m_shards[index]->reactor->wake();
+    }else{
+      m_shards[0]->reactor->wake(index);
+    }
   }
 
   bool IOManager::stopping(){
-    uint64_t timeout = getNextTimer();
+    if (hasTimer()){
+      return false;
+    }
+    for (auto &shard : m_shards){
+      if (shard->pendingEventCount){
+        return false;
+      }
+    }
     // 没有超时，没有待处理的事件，调度器也停止了
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return Scheduler::stopping();
   }
 
   // idle 处于空闲，等待被唤醒
@@ -311,67 +523,97 @@ namespace colib{
   * 并且通过协程调度提高程序的并发能力。
   */
   void IOManager::idle(){
-    // 每次epoll wait最多检测256个就绪事件
+    // 每次最多处理256个就绪事件
     static const int MAX_EVENTS = 256;
-    std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVENTS]);
+    std::unique_ptr<Reactor::ReadyEvent[]> events(new Reactor::ReadyEvent[MAX_EVENTS]);
+    // 跨轮次复用，避免每轮分配
+    ReadyList ready;
+    // 分片模式下只等待本线程的分片，就绪的任务也固定在本线程执行
+    Shard &shard = m_sharded ? *m_shards[getWorkerIndex()] : *m_shards[0];
+    size_t waiter = m_sharded ? 0 : getWorkerIndex();
+    int pin_thread = m_sharded ? Thread::GetThreadID() : -1;
 
     while(true){
       if (debug)
         std::cout << "IOManager::idle(),run in thread: " << Thread::GetThreadID() << std::endl;
 
+        // 本轮计算等待时间使用的时间，协程在两轮之间可能运行了很久，所以每轮都要更新
+        updateNow();
         if(stopping()){
           if (debug)
             std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadID() << std::endl;
+          // stop()连续的tickle会合并成一次唤醒，退出前把唤醒传给下一个还在等待的线程
+          tickle();
           break;
         }
 
-        // 阻塞在epoll wait，等待事件发生
-        int rt = 0;
-        while(true){
-          static const uint64_t MAX_TIMEOUT = 5000;
-          uint64_t next_timeout = getNextTimer();
-          next_timeout = std::min(next_timeout, MAX_TIMEOUT);
-
-          rt = epoll_wait(m_epfd, events.get(), MAX_EVENTS, (int)next_timeout);
-          if(rt < 0 && errno == EINTR){
-            continue;
-          }else{
-            break;
+        // 阻塞等待事件发生，tickle会唤醒
+        static const uint64_t MAX_TIMEOUT = 5000000000ull;
+        uint64_t next_timeout = nextDeadline(shard, std::min(getNextTimerNs(), MAX_TIMEOUT));
+        if (m_highResTimers.load(std::memory_order_relaxed)) {
+          // 默认50微秒的timer slack会让内核推迟唤醒，每个线程设置一次
+          static thread_local bool slack_set = false;
+          if (!slack_set) {
+            prctl(PR_SET_TIMERSLACK, 1UL);
+            slack_set = true;
           }
+        } else {
+          next_timeout = (next_timeout + 999999) / 1000000 * 1000000;
         }
-
-        // 收集所有定时器超时事件
-        std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()){
-          for(const auto&cb:cbs){
-            scheduleLock(cb); // 存入任务队列，唤醒协程
+        int rt = busyPoll(shard, events.get(), MAX_EVENTS, next_timeout);
+        if (rt < 0) {
+          // 先登记等待再检查任务，入队之后的wake()一定能看到这个等待者
+          shard.reactor->prepareWait(waiter);
+          if (hasReadyTask() || hasPostedTimers()) {
+            next_timeout = 0;
           }
-          cbs.clear();
+          rt = shard.reactor->wait(waiter, events.get(), MAX_EVENTS, (int64_t)next_timeout);
+        }
+
+        // 收集所有定时器超时事件，等待之后时间已经变化
+        // 协程定时器的协程和就绪事件的协程一起调度，inline定时器和侵入式定时器的回调在这里直接执行
+        updateNow();
+        listExpired(ready.cbs, ready.fibers, ready.inlineCbs);
+        for (auto &cb : ready.inlineCbs){
+          cb();
         }
+        ready.inlineCbs.clear();
+        runExpiredNodes();
 
         // 收集所有就绪事件
         for (int i = 0; i < rt;i++){
-          epoll_event &event = events[i];
-
-          // ticklefd[0]用于通知协程调度，此时读完管道的数据，
-          // 本轮idle结束之后，协程会重新调度
-          if(event.data.fd==m_tickleFds[0]){
-            uint8_t dummy[256];
-            while(read(m_tickleFds[0],dummy,sizeof(dummy))>0)
-              ;
-            continue;
-          }
+          Reactor::ReadyEvent &event = events[i];
 
-          // 通过epoll event的私有指针获取fd cntext
-          FdContext *fd_ctx = (FdContext *)event.data.ptr;
+          // 通过私有指针获取fd cntext
+          FdContext *fd_ctx = (FdContext *)event.data;
           std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
+          // 持久注册：有等待者的事件直接触发，没有的缓存起来，不修改后端
+          if (fd_ctx->persistent){
+            int fired = NONE;
+            if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)){
+              fired |= READ;
+            }
+            if (event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)){
+              fired |= WRITE;
+            }
+            fd_ctx->ready |= fired & ~fd_ctx->events;
+            if (fired & fd_ctx->events & READ){
+              fd_ctx->triggerEvent(READ, &ready);
+              --shard.pendingEventCount;
+            }
+            if (fired & fd_ctx->events & WRITE){
+              fd_ctx->triggerEvent(WRITE, &ready);
+              --shard.pendingEventCount;
+            }
+            continue;
+          }
+
           // EPOLLERR or EPOLLHUP 转换成其它读写事件
           if (event.events & (EPOLLERR | EPOLLHUP)){
             event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
           }
-          // 事件发生在epoll wait时
+          // 事件发生在wait时，io_uring的完成事件收割之后注册可能已经被修改，只保留仍然关注的事件
           int real_events = NONE;
           if (event.events & EPOLLIN){
             real_events |= READ;
@@ -379,33 +621,39 @@ namespace colib{
           if (event.events & EPOLLOUT){
             real_events |= WRITE;
           }
-          if ((fd_ctx->events & real_events) == NONE){
+          real_events &= fd_ctx->events;
+          if (real_events == NONE){
             continue;
           }
 
-          // 删除已经发生的事件
-          // 根据op的值，对epfd进行op操作，操作对象是fd，event是监听的事件类型
+          // 删除已经发生的事件，剩下的事件重新注册
           int left_events = (fd_ctx->events & ~real_events);
-          int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-          event.events = EPOLLET | left_events;
-          int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-          if(rt2){
-            std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl;
+          if (!shard.reactor->update(fd_ctx->fd, fd_ctx, fd_ctx->events, left_events)){
             continue;
           }
 
           // 处理已经发生的事情，让调度器调度指定的函数或者协程
           if (real_events & READ)
           {
-            fd_ctx->triggerEvent(READ);
-            --m_pendingEventCount;
+            fd_ctx->triggerEvent(READ, &ready);
+            --shard.pendingEventCount;
           }
           if (real_events & WRITE)
           {
-            fd_ctx->triggerEvent(WRITE);
-            --m_pendingEventCount;
+            fd_ctx->triggerEvent(WRITE, &ready);
+            --shard.pendingEventCount;
           }
         }
+
+        // 就绪的事件先处理，同一轮中到期的不再算超时
+        expireDeadlines(shard, ready);
+
+        // 超时回调和就绪事件一起批量放入任务队列，唤醒协程
+        // 分片模式下定时器在添加它的线程上到期，共享栈协程由scheduleBatch放回绑定的线程
+        scheduleBatch(ready.cbs, pin_thread);
+        scheduleBatch(ready.fibers, pin_thread);
+        ready.cbs.clear();
+        ready.fibers.clear();
         // 处理完所有事情后，idle协程退出
         // 调度协程会重新检查是否有新任务调度
         // trigglerEvent只会把相应的fiber重新加入调度
@@ -414,19 +662,118 @@ namespace colib{
     }
   }
 
+  // 默认模式下等待时间之后会向上取整到毫秒，公布的是取整前的时间，落在这一毫秒内的超时最多晚1毫秒
+  uint64_t IOManager::nextDeadline(Shard &shard, uint64_t timeout_ns){
+    int64_t now = loopNow().time_since_epoch().count();
+    shard.armed.store(now + (int64_t)timeout_ns);
+    // 先公布等待时间再读取超时数，和addEvent先加入超时堆再读取等待时间配对
+    if (!shard.deadlineCount.load()){
+      return timeout_ns;
+    }
+    std::lock_guard<std::mutex> lock(shard.deadlineMutex);
+    if (shard.deadlines.empty()){
+      return timeout_ns;
+    }
+    int64_t wake = shard.deadlines[0].deadline + getTimerSlack().count();
+    if (wake - now >= (int64_t)timeout_ns){
+      return timeout_ns;
+    }
+    shard.armed.store(wake);
+    return wake > now ? (uint64_t)(wake - now) : 0;
+  }
+
+  void IOManager::expireDeadlines(Shard &shard, ReadyList &ready){
+    if (!shard.deadlineCount.load(std::memory_order_relaxed)){
+      return;
+    }
+    int64_t now = loopNow().time_since_epoch().count();
+    // 在超时堆的锁内只收集，取消事件需要先拿fd context的锁
+    {
+      std::lock_guard<std::mutex> lock(shard.deadlineMutex);
+      size_t stack[64];
+      size_t top = 0;
+      if (!shard.deadlines.empty()){
+        stack[top++] = 0;
+      }
+      while (top){
+        size_t i = stack[--top];
+        const Shard::Deadline &d = shard.deadlines[i];
+        if (d.deadline > now){
+          continue;
+        }
+        ready.timedOut.emplace_back(d.ctx, d.event);
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < shard.deadlines.size(); ++child){
+          stack[top++] = child;
+        }
+      }
+    }
+
+    for (auto &item : ready.timedOut){
+      FdContext *fd_ctx = item.first;
+      Event event = item.second;
+      std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+      // 期间已经就绪、被取消或者重新添加了更晚的超时
+      FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+      if (!(fd_ctx->events & event) || event_ctx.deadline > now){
+        continue;
+      }
+      // 和cancelEvent一样移除事件；移除失败（比如fd已经被直接close）时也结束等待，
+      // 否则到期的项一直留在超时堆中，事件循环不再阻塞
+      // 这里不清零errno：在线程间迁移的协程可能缓存了本线程errno的地址
+      Event new_events = (Event)(fd_ctx->events & ~event);
+      if (!fd_ctx->persistent && !shard.reactor->update(fd_ctx->fd, fd_ctx, fd_ctx->events, new_events)){
+        event_ctx.status = errno ? errno : EIO;
+      }else{
+        event_ctx.status = ETIMEDOUT;
+      }
+      --shard.pendingEventCount;
+      fd_ctx->triggerEvent(event, &ready);
+    }
+    ready.timedOut.clear();
+  }
+
+  // IO协程调度器的线程中阻塞的系统调用都由hook变成协程切换
+  void IOManager::onThreadStart(){
+    set_hook_enable(true);
+  }
+
   void IOManager::onTimerInsertedAtFront(){
     tickle();
   }
 
-  // nolock
-  void IOManager::contextResize(size_t size){
-    m_fdContexts.resize(size);
+  void IOManager::setPerThreadTimers(bool on){
+    if (on){
+      // caller线程在stop()之前不处理定时器
+      size_t workers = getWorkerCount();
+      setThreadQueues(workers, isUseCaller() && workers > 1 ? 1 : 0);
+    }
+  }
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i){
-      if (m_fdContexts[i] == nullptr){
-        m_fdContexts[i] = new FdContext();
-        m_fdContexts[i]->fd = i;
-      }
+  // 只叫醒队列所属的线程
+  void IOManager::onTimerPosted(int queue){
+    tickleThread(getWorkerThread(queue));
+  }
+
+  IOManager::Shard &IOManager::shardFor(int fd){
+    if (!m_sharded){
+      return *m_shards[0];
+    }
+    // 不是工作线程时按fd分配
+    int index = getWorkerIndex();
+    if (index < 0){
+      index = fd > 0 ? fd % m_shards.size() : 0;
+    }
+    return *m_shards[index];
+  }
+
+  // create为false时fd所在的块还没有分配返回nullptr
+  IOManager::FdContext *IOManager::getFdContext(Shard &shard, int fd, bool create){
+    if (!create){
+      return shard.fdContexts.get(fd);
     }
+    return shard.fdContexts.getOrCreate(fd, [&shard](FdContext &fd_ctx, int fd){
+      fd_ctx.fd = fd;
+      fd_ctx.shard = &shard;
+    });
   }
 }
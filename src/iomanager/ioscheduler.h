@@ -3,6 +3,11 @@
 
 #include "../scheduler/scheduler.h"
 #include "../timer/timer.h"
+#include "reactor.h"
+#include "../util/fd_table.h"
+
+#include <sys/socket.h>
+#include <functional>
 
 namespace colib{
   /*
@@ -23,6 +28,17 @@ namespace colib{
     };
   
   private:
+    struct FdContext;
+    struct Shard;
+
+    // idle一轮中就绪的回调和协程，收集后批量调度
+    struct ReadyList{
+      std::vector<Callback> cbs;
+      std::vector<std::shared_ptr<Fiber>> fibers;
+      std::vector<Callback> inlineCbs; // inline定时器的回调，在idle中直接执行
+      std::vector<std::pair<FdContext *, Event>> timedOut; // 到期的带超时事件
+    };
+
     /*事件上下文类
     * fd的每个事件都有一个上下文，保存这个事件的回调函数和调度器
     */
@@ -30,47 +46,148 @@ namespace colib{
       struct EventContext{
         Scheduler *scheduler = nullptr; // 调度器
         std::shared_ptr<Fiber> fiber;   // 协程
-        std::function<void()> cb;       // 回调函数
+        Callback cb;                    // 回调函数
+        int64_t deadline = INT64_MAX;   // 超时时间（steady_clock计数），设置了时在分片的超时堆中
+        uint32_t heapIndex = ~0u;       // 在超时堆中的位置，由分片的deadlineMutex保护
+        int status = 0;                 // 上一次等待结束的原因，0为就绪或被取消；重置上下文时保留，由等待者读取
       };
 
       EventContext read;
       EventContext write;
       int fd = 0;
       Event events = NONE; // events registered
+      bool persistent = false; // 以读写边缘触发的方式一直注册在后端中
+      bool busyPoll = false;   // 已经尝试设置过SO_BUSY_POLL
+      int ready = NONE;        // 持久注册时已经就绪、还没有被addEvent消费的事件
+      Shard *shard = nullptr;  // 所在的分片
       std::mutex mutex;
 
       EventContext &getEventContext(Event event);
       void resetEventContext(EventContext &ctx);
-      void triggerEvent(Event event);
+      // 传入ready时，由当前调度器执行的事件先收集起来，由调用者批量调度
+      void triggerEvent(Event event, ReadyList *ready = nullptr);
+    };
+
+    /* 一个多路复用后端和它的fd表
+    * 共享模式下所有线程共用一个；分片模式下每个工作线程一个，fd由注册它的线程的分片负责，
+    * 事件也只在这个线程上等待和处理，连接不会在线程之间迁移
+    */
+    struct alignas(64) Shard{
+      std::unique_ptr<Reactor> reactor;                // IO多路复用后端，监视文件描述符的状态变化
+      FdTable<FdContext> fdContexts;                   // 下标为fd，无锁查找，按块分配
+      std::atomic<size_t> pendingEventCount = {0};     // 待处理的事件数
+      size_t index = 0;                                // 分片模式下是所属工作线程的下标
+
+      // 带超时的事件：按超时时间的二叉堆，在等待时间中考虑，到期时在idle中取消事件
+      // 加锁顺序：先fd context的锁，再deadlineMutex
+      struct Deadline{
+        int64_t deadline;
+        FdContext *ctx;
+        Event event;
+      };
+      std::mutex deadlineMutex;
+      std::vector<Deadline> deadlines;
+      std::atomic<size_t> deadlineCount = {0};
+      std::atomic<int64_t> armed = {INT64_MAX}; // 等待到的时间，早于它的超时需要唤醒
+
+      void pushDeadline(FdContext *ctx, Event event, int64_t deadline);
+      void eraseDeadline(size_t i);
+      void siftUp(size_t i);
+      void siftDown(size_t i);
+      void place(size_t i, const Deadline &d);
     };
   
   public:
     // 改造协程调度器，使其支持epoll,重载tickle和idle
     // 实现通知调度协程和IO协程调度功能
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    // backend选择IO多路复用的后端，内核不支持io_uring时退回epoll
+    // sharded为true时每个工作线程有自己的后端和fd表（thread-per-core），
+    // 事件在注册它的线程上处理，就绪的回调和协程也只在这个线程上执行；定时器自动使用每线程的队列（setPerThreadTimers）
+    // timer_queue选择定时器的组织方式，大量超时定时器（每个请求一个）时使用时间轮
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager",
+              Reactor::Backend backend = Reactor::EPOLL, bool sharded = false,
+              TimerManager::Queue timer_queue = TimerManager::HEAP);
     ~IOManager();
 
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Callback cb = nullptr);
+    // 带超时的事件：deadline之前没有就绪时在事件循环中取消事件，再唤醒协程或者执行回调，
+    // 被唤醒后用takeEventStatus区分是否超时。超时和事件在同一把锁下处理，不需要另外的定时器
+    int addEvent(int fd, Event event, Callback cb, Clock::time_point deadline);
+    // 读取并清除fd上一次等待event结束的原因：0为就绪或被取消，超时为ETIMEDOUT，
+    // 超时后从后端移除注册失败时为对应的errno。结果保存在fd context中，等待者的栈可能是共享栈，不能由事件循环写入
+    int takeEventStatus(int fd, Event event);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
     bool cancelAll(int fd);
 
+    // 每个工作线程打开一个SO_REUSEPORT的非阻塞监听fd，并在这个线程上执行cb(listen_fd)，
+    // 由内核在这些fd之间分配新连接；cb中addEvent的fd都属于这个线程。失败返回false
+    bool listenPerWorker(const sockaddr *addr, socklen_t addrlen, int backlog,
+                         std::function<void(int)> cb);
+
+    // 持久注册：fd第一次addEvent时以EPOLLIN|EPOLLOUT|EPOLLRDHUP边缘触发注册一次，之后不再epoll_ctl
+    // 没有等待者时的就绪事件缓存在fd context中，下一次addEvent直接完成
+    // fd关闭前需要cancelAll(fd)移除注册（hook的close会这样做）；后端不支持时（io_uring）不生效
+    // 需要在添加事件之前设置
+    void setPersistentRegistration(bool on) { m_persistent = on && m_shards[0]->reactor->supportsPersistent(); }
+    bool isPersistentRegistration() const { return m_persistent; }
+
+    // 忙轮询：空闲线程阻塞等待之前，先以0超时轮询后端并检查任务队列，最多spin_us微秒，0表示关闭
+    // cpu_percent限制所有线程忙轮询的总时间，100表示最多占满一个核，用完之后直接阻塞等待
+    // so_busy_poll_us不为0时给注册的socket设置SO_BUSY_POLL（超过系统设置需要CAP_NET_ADMIN，失败忽略）
+    void setBusyPoll(uint32_t spin_us, uint32_t cpu_percent = 100, int so_busy_poll_us = 0);
+
+    // 高精度定时器：等待按纳秒精度的最近超时时间（epoll_pwait2/io_uring超时），并把工作线程的timer slack设为1纳秒，
+    // 适合100微秒级别的定时（发送限速等）；关闭时等待时间向上取整到毫秒，亚毫秒的定时器最多晚1毫秒
+    void setHighResolutionTimers(bool on) { m_highResTimers = on; }
+    bool isHighResolutionTimers() const { return m_highResTimers; }
+
+    // 每个工作线程有自己的定时器队列：定时器属于创建它的线程，在这个线程上到期，
+    // 本线程添加、取消定时器不加锁，其它线程通过无锁的收件箱交给所属线程；需要在添加定时器之前设置
+    // 线程长时间运行一个协程时，它的定时器要等它回到事件循环才会触发；分片模式下总是开启
+    void setPerThreadTimers(bool on);
+
     static IOManager *GetThis();
 
+    // 实际使用的后端
+    Reactor::Backend getBackend() const { return m_shards[0]->reactor->getBackend(); }
+    const char *getBackendName() const { return m_shards[0]->reactor->getName(); }
+    bool isSharded() const { return m_sharded; }
+
   protected:
     void tickle() override;
+    void tickleThread(int thread) override;
     bool stopping() override;
     void idle() override;
+    void onThreadStart() override;
     void onTimerInsertedAtFront() override;
+    int currentTimerQueue() override { return getRunningWorkerIndex(); }
+    void onTimerPosted(int queue) override;
 
-    void contextResize(size_t size);
+  private:
+    Shard &shardFor(int fd); // 当前线程注册fd时使用的分片
+    FdContext *getFdContext(Shard &shard, int fd, bool create);
+    int busyPoll(Shard &shard, Reactor::ReadyEvent *events, int max_events, uint64_t timeout_ns);
+    // 把事件的超时考虑进等待时间，timeout_ns是定时器给出的等待时间，返回实际的等待时间
+    uint64_t nextDeadline(Shard &shard, uint64_t timeout_ns);
+    // 取消到期的事件
+    void expireDeadlines(Shard &shard, ReadyList &ready);
+    bool delEvent(Shard &shard, int fd, Event event);
+    bool cancelEvent(Shard &shard, int fd, Event event);
+    bool cancelAll(Shard &shard, int fd);
 
   private:
-    int m_epfd = 0;     // epoll文件描述符，监视文件描述符的状态变化
-    int m_tickleFds[2]; // fd[0]=read fd[1]=write，用于触发事件的管道文件描述符数组
-    std::atomic<size_t> m_pendingEventCount = {0}; // 待处理的事件数
-    std::shared_mutex m_mutex;                     // 共享锁
-    std::vector<FdContext *> m_fdContexts;         // 存储待处理的文件描述符和相关上下文信息
+    bool m_sharded = false;
+    bool m_persistent = false;
+    std::atomic<bool> m_highResTimers = {false};
+
+    // 忙轮询
+    uint32_t m_busyPollUs = 0;
+    uint64_t m_busyPollBudgetUs = 0;            // 每个统计窗口内所有线程忙轮询的总时间上限
+    int m_soBusyPollUs = 0;
+    std::atomic<uint64_t> m_busyPollWindow = {0}; // 当前统计窗口的序号
+    std::atomic<uint64_t> m_busyPollSpentUs = {0}; // 当前窗口已经用掉的忙轮询时间
+    std::vector<std::unique_ptr<Shard>> m_shards;
   };
 }
 
@@ -0,0 +1,324 @@
+#include "reactor.h"
+#include "uring_reactor.h"
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+namespace colib
+{
+  std::unique_ptr<Reactor> Reactor::Create(Backend backend, size_t waiters)
+  {
+    std::unique_ptr<Reactor> reactor;
+    if (backend == IO_URING)
+    {
+      std::unique_ptr<UringReactor> uring(new UringReactor());
+      if (uring->isValid())
+      {
+        reactor = std::move(uring);
+      }
+    }
+    if (!reactor)
+    {
+      reactor.reset(new EpollReactor());
+    }
+
+    if (waiters > 1)
+    {
+      reactor->m_waiterCount = waiters;
+      reactor->m_waiters.reset(new Waiter[waiters]);
+      for (size_t i = 0; i < waiters; ++i)
+      {
+        reactor->m_waiters[i].fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(reactor->m_waiters[i].fd >= 0);
+      }
+    }
+    return reactor;
+  }
+
+  Reactor::~Reactor()
+  {
+    for (size_t i = 0; i < m_waiterCount; ++i)
+    {
+      close(m_waiters[i].fd);
+    }
+  }
+
+  void Reactor::prepareWait(size_t waiter)
+  {
+    if (m_waiters)
+    {
+      assert(waiter < m_waiterCount);
+      // 上一轮等待结束之后才到达的通知在这里丢弃，登记之后的通知一定会叫醒本轮等待
+      m_waiters[waiter].notified = false;
+      m_waiters[waiter].sleeping = true;
+    }
+    ++m_sleepers;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  int Reactor::wait(size_t waiter, ReadyEvent *events, int max_events, int64_t timeout_ns)
+  {
+    if (!m_waiters)
+    {
+      int n = waitBackend(events, max_events, timeout_ns);
+      --m_sleepers;
+      return n;
+    }
+
+    Waiter &self = m_waiters[waiter];
+    int n = 0;
+    int leader = -1;
+    if (m_leader.compare_exchange_strong(leader, (int)waiter))
+    {
+      // 和notify()配对：成为leader之前的通知写到了自己的eventfd，在后端上等不到，不再阻塞
+      if (self.notified)
+      {
+        timeout_ns = 0;
+      }
+      n = waitBackend(events, max_events, timeout_ns);
+      m_leader = -1;
+
+      // 叫醒一个跟随者接替等待后端，已经被通知的会自己回来
+      for (size_t i = 0; i < m_waiterCount; ++i)
+      {
+        Waiter &other = m_waiters[i];
+        if (i != waiter && other.sleeping)
+        {
+          if (!other.notified.exchange(true))
+          {
+            notify(i);
+          }
+          break;
+        }
+      }
+    }
+    else
+    {
+      waitFollower(self, timeout_ns);
+    }
+    self.sleeping = false;
+    --m_sleepers;
+    return n;
+  }
+
+  int Reactor::poll(ReadyEvent *events, int max_events)
+  {
+    bool woken = false;
+    int n = doWait(events, max_events, 0, woken);
+    if (woken)
+    {
+      // 收割到的是发给等待者的唤醒，m_notified保持不变，重新发出
+      doWake();
+    }
+    return n;
+  }
+
+  bool Reactor::wake()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers == 0)
+    {
+      return false;
+    }
+    if (m_waiters)
+    {
+      // 优先叫醒跟随者，leader继续等待后端
+      int leader = m_leader;
+      for (size_t i = 0; i < m_waiterCount; ++i)
+      {
+        Waiter &other = m_waiters[i];
+        if ((int)i != leader && other.sleeping && !other.notified.exchange(true))
+        {
+          notify(i);
+          return true;
+        }
+      }
+    }
+    if (!m_notified.exchange(true))
+    {
+      doWake();
+    }
+    return true;
+  }
+
+  bool Reactor::wake(size_t waiter)
+  {
+    if (!m_waiters)
+    {
+      return wake();
+    }
+    assert(waiter < m_waiterCount);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Waiter &target = m_waiters[waiter];
+    if (!target.sleeping)
+    {
+      return false;
+    }
+    if (!target.notified.exchange(true))
+    {
+      notify(waiter);
+    }
+    return true;
+  }
+
+  int Reactor::waitBackend(ReadyEvent *events, int max_events, int64_t timeout_ns)
+  {
+    bool woken = false;
+    int n = doWait(events, max_events, timeout_ns, woken);
+    if (woken)
+    {
+      // 之后的wake()才会再次通知
+      m_notified = false;
+    }
+    return n;
+  }
+
+  void Reactor::waitFollower(Waiter &self, int64_t timeout_ns)
+  {
+    pollfd pfd;
+    pfd.fd = self.fd;
+    pfd.events = POLLIN;
+    timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    int rt = 0;
+    do
+    {
+      rt = ppoll(&pfd, 1, timeout_ns < 0 ? nullptr : &ts, nullptr);
+    } while (rt < 0 && errno == EINTR);
+    if (rt > 0)
+    {
+      uint64_t count;
+      rt = read(self.fd, &count, sizeof(count));
+      (void)rt;
+    }
+  }
+
+  void Reactor::notify(size_t waiter)
+  {
+    // 和wait()中成为leader之后检查notified配对：要么这里看到它已经是leader，要么它看到通知不再阻塞
+    if (m_leader == (int)waiter)
+    {
+      if (!m_notified.exchange(true))
+      {
+        doWake();
+      }
+      return;
+    }
+    uint64_t one = 1;
+    int rt = write(m_waiters[waiter].fd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    (void)rt;
+  }
+
+  /* epoll */
+  EpollReactor::EpollReactor()
+  {
+    // 创建epoll fd
+    m_epfd = epoll_create(5000);
+    assert(m_epfd > 0);
+
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_wakeFd >= 0);
+
+    // 边缘触发，不需要read清空计数（要写2^64次才会满）；还没有收割的多次write只产生一次通知，
+    // 所以m_notified保证同一时刻最多只有一次未消费的唤醒，它只用来叫醒在epoll_wait中的leader
+    // 私有指针指向自己，和fd的私有指针区分开
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = this;
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakeFd, &event);
+    assert(!rt);
+  }
+
+  EpollReactor::~EpollReactor()
+  {
+    close(m_epfd);
+    close(m_wakeFd);
+  }
+
+  bool EpollReactor::update(int fd, void *data, uint32_t old_events, uint32_t new_events)
+  {
+    int op = new_events ? (old_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = data;
+
+    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    if (rt)
+    {
+      std::cerr << "EpollReactor::update epoll_ctl failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  std::atomic<bool> EpollReactor::s_hasPwait2 = {true};
+
+  int EpollReactor::doWait(ReadyEvent *events, int max_events, int64_t timeout_ns, bool &woken)
+  {
+    epoll_event epevents[MAX_EVENTS];
+    max_events = std::min(max_events, MAX_EVENTS);
+
+    // 整毫秒的超时（包括0和-1）直接用epoll_wait
+    bool precise = timeout_ns > 0 && timeout_ns % 1000000 && s_hasPwait2.load(std::memory_order_relaxed);
+    timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    int timeout_ms = timeout_ns < 0 ? -1 : (int)std::min<int64_t>((timeout_ns + 999999) / 1000000, INT32_MAX);
+
+    int rt = 0;
+    while (true)
+    {
+      if (precise)
+      {
+        rt = epoll_pwait2(m_epfd, epevents, max_events, &ts, nullptr);
+        if (rt < 0 && errno == ENOSYS)
+        {
+          s_hasPwait2 = false;
+          precise = false;
+          continue;
+        }
+      }
+      else
+      {
+        rt = epoll_wait(m_epfd, epevents, max_events, timeout_ms);
+      }
+      if (rt < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+
+    int n = 0;
+    for (int i = 0; i < rt; ++i)
+    {
+      // 唤醒通知
+      if (epevents[i].data.ptr == this)
+      {
+        woken = true;
+        continue;
+      }
+      events[n].data = epevents[i].data.ptr;
+      events[n].events = epevents[i].events;
+      ++n;
+    }
+    return n;
+  }
+
+  void EpollReactor::doWake()
+  {
+    uint64_t one = 1;
+    int rt = write(m_wakeFd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    (void)rt;
+  }
+}
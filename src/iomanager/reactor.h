@@ -0,0 +1,119 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace colib
+{
+  /*
+   * IO多路复用的后端，IOManager通过它注册fd事件和等待就绪
+   * 事件位使用epoll/poll的取值（EPOLLIN=POLLIN，EPOLLOUT=POLLOUT，EPOLLERR，EPOLLHUP），
+   * 注册都是一次性的：事件触发之后由调用者用剩下的事件重新update
+   * 唤醒只针对真正在等待的线程：等待前prepareWait()登记，再检查一次有没有任务，然后wait()；
+   * wake()在没有等待者、或者上一次唤醒还没有被消费时什么都不做，否则只做一次系统调用叫醒一个线程
+   * 多个线程等待同一个后端时，同一时刻只有一个线程（leader）在后端上等待，其它线程各自等待自己的eventfd，
+   * 所以wake(waiter)可以只叫醒指定的线程；leader返回时叫醒一个跟随者接替它等待后端
+   */
+  class Reactor
+  {
+  public:
+    enum Backend
+    {
+      EPOLL,
+      IO_URING
+    };
+
+    struct ReadyEvent
+    {
+      void *data;      // update时传入的私有指针
+      uint32_t events; // 就绪的事件
+    };
+
+    // 创建指定的后端，内核不支持io_uring时退回epoll
+    // waiters为调用wait()的线程数，这些线程用0到waiters-1的编号区分
+    static std::unique_ptr<Reactor> Create(Backend backend, size_t waiters = 1);
+
+    virtual ~Reactor();
+
+    virtual Backend getBackend() const = 0;
+    virtual const char *getName() const = 0;
+
+    // fd关注的事件从old_events改为new_events，new_events为0表示不再关注
+    virtual bool update(int fd, void *data, uint32_t old_events, uint32_t new_events) = 0;
+
+    // 注册是否可以一直有效（边缘触发，触发后不需要重新update）
+    virtual bool supportsPersistent() const { return false; }
+
+    // 编号为waiter的线程登记为等待者，之后必须调用wait()
+    void prepareWait(size_t waiter = 0);
+
+    // 等待就绪事件，最多等timeout_ns纳秒（-1一直等待），返回就绪事件数，被wake()唤醒时可能返回0
+    // 不是整毫秒的超时需要后端支持纳秒精度的等待，否则向上取整到毫秒
+    int wait(size_t waiter, ReadyEvent *events, int max_events, int64_t timeout_ns);
+
+    // 不阻塞地收割一次就绪事件，调用者不算等待者，不会被wake()唤醒
+    int poll(ReadyEvent *events, int max_events);
+
+    // 唤醒一个正在等待的线程，没有等待者时返回false
+    bool wake();
+    // 只唤醒编号为waiter的线程，它没有在等待时返回false
+    bool wake(size_t waiter);
+
+  protected:
+    // woken表示收到了doWake()发出的唤醒
+    virtual int doWait(ReadyEvent *events, int max_events, int64_t timeout_ns, bool &woken) = 0;
+    virtual void doWake() = 0;
+
+  private:
+    // 多个线程等待时每个线程一个
+    struct Waiter
+    {
+      std::atomic<bool> sleeping = {false}; // 已经登记等待
+      std::atomic<bool> notified = {false}; // 本轮等待已经被通知
+      int fd = -1;                          // 不是leader时等待的eventfd
+    };
+
+    int waitBackend(ReadyEvent *events, int max_events, int64_t timeout_ns);
+    void waitFollower(Waiter &self, int64_t timeout_ns);
+    void notify(size_t waiter); // 通知已经标记为notified的等待者
+
+  private:
+    std::atomic<int> m_sleepers = {0};     // 登记了等待的线程数
+    std::atomic<bool> m_notified = {false}; // 已经发出还没有被消费的后端唤醒
+    std::atomic<int> m_leader = {-1};      // 在后端上等待的线程编号
+    size_t m_waiterCount = 0;
+    std::unique_ptr<Waiter[]> m_waiters;   // 只有一个等待者时为空，直接在后端上等待
+  };
+
+  /* epoll后端，用eventfd唤醒
+   * 亚毫秒的超时使用epoll_pwait2（Linux 5.11），带纳秒精度的超时；
+   * 内核不支持时退回epoll_wait，超时向上取整到毫秒
+   */
+  class EpollReactor : public Reactor
+  {
+  public:
+    EpollReactor();
+    ~EpollReactor();
+
+    Backend getBackend() const override { return EPOLL; }
+    const char *getName() const override { return "epoll"; }
+    bool supportsPersistent() const override { return true; }
+
+    bool update(int fd, void *data, uint32_t old_events, uint32_t new_events) override;
+
+  protected:
+    int doWait(ReadyEvent *events, int max_events, int64_t timeout_ns, bool &woken) override;
+    void doWake() override;
+
+  private:
+    static constexpr int MAX_EVENTS = 256;
+    static std::atomic<bool> s_hasPwait2; // epoll_pwait2是否可用，第一次返回ENOSYS后不再尝试
+
+    int m_epfd = -1;   // epoll文件描述符
+    int m_wakeFd = -1; // 用于唤醒的eventfd
+  };
+}
+
+#endif
@@ -0,0 +1,363 @@
+#include "uring_reactor.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace colib
+{
+  // 特殊的user_data，fd的注册使用 (序号 << 32) | fd
+  static const uint64_t WAKE_TAG = ~0ull;
+  static const uint64_t TIMEOUT_TAG = ~0ull - 1;
+  static const uint64_t REMOVE_TAG = ~0ull - 2;
+
+  static uint64_t UserData(int fd, uint32_t seq)
+  {
+    return ((uint64_t)seq << 32) | (uint32_t)fd;
+  }
+
+  static int Enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+  {
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+  }
+
+  static unsigned LoadAcquire(const unsigned *p)
+  {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+
+  static void StoreRelease(unsigned *p, unsigned v)
+  {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+  }
+
+  UringReactor::UringReactor(unsigned entries)
+  {
+    if (!setup(entries))
+    {
+      return;
+    }
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0)
+    {
+      std::cerr << "UringReactor eventfd failed: " << strerror(errno) << std::endl;
+      close(m_ringFd);
+      m_ringFd = -1;
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    armWake();
+  }
+
+  UringReactor::~UringReactor()
+  {
+    if (m_sqes)
+    {
+      munmap(m_sqes, m_sqesSize);
+    }
+    if (m_sqRing)
+    {
+      munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_ringFd >= 0)
+    {
+      close(m_ringFd);
+    }
+    if (m_wakeFd >= 0)
+    {
+      close(m_wakeFd);
+    }
+  }
+
+  bool UringReactor::setup(unsigned entries)
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_ringFd < 0)
+    {
+      m_ringFd = -1;
+      return false;
+    }
+
+    // 需要单次mmap两个环（5.4），以及READ使用当前位置（5.6，eventfd不能指定偏移）
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+      close(m_ringFd);
+      m_ringFd = -1;
+      return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqRingSize = std::max(sq_size, cq_size);
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+    {
+      m_sqRing = nullptr;
+      close(m_ringFd);
+      m_ringFd = -1;
+      return false;
+    }
+    m_cqRing = m_sqRing;
+    m_cqRingSize = m_sqRingSize;
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  m_ringFd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+      m_sqes = nullptr;
+      munmap(m_sqRing, m_sqRingSize);
+      m_sqRing = nullptr;
+      close(m_ringFd);
+      m_ringFd = -1;
+      return false;
+    }
+
+    char *sq = (char *)m_sqRing;
+    m_sqHead = (unsigned *)(sq + params.sq_off.head);
+    m_sqTail = (unsigned *)(sq + params.sq_off.tail);
+    m_sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    m_sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    m_sqArray = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (unsigned *)(cq + params.cq_off.head);
+    m_cqTail = (unsigned *)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // 取一个空的SQE，提交队列满了先交给内核
+  io_uring_sqe *UringReactor::getSqe()
+  {
+    unsigned tail = *m_sqTail;
+    if (tail - LoadAcquire(m_sqHead) >= m_sqEntries)
+    {
+      int rt = Enter(m_ringFd, m_unsubmitted, 0, 0);
+      if (rt > 0)
+      {
+        m_unsubmitted -= rt;
+      }
+      if (tail - LoadAcquire(m_sqHead) >= m_sqEntries)
+      {
+        std::cerr << "UringReactor submission queue full" << std::endl;
+        return nullptr;
+      }
+    }
+    io_uring_sqe *sqe = &m_sqes[tail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  // 填好之后再移动tail，内核不会看到写了一半的SQE
+  static void CommitSqe(unsigned *sq_tail, unsigned *sq_array, unsigned mask)
+  {
+    unsigned tail = *sq_tail;
+    sq_array[tail & mask] = tail & mask;
+    StoreRelease(sq_tail, tail + 1);
+  }
+
+  void UringReactor::armWake()
+  {
+    io_uring_sqe *sqe = getSqe();
+    if (!sqe)
+    {
+      return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakeFd;
+    sqe->addr = (uint64_t)&m_wakeBuf;
+    sqe->len = sizeof(m_wakeBuf);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = WAKE_TAG;
+    CommitSqe(m_sqTail, m_sqArray, m_sqMask);
+    ++m_unsubmitted;
+  }
+
+  // 等待者已经在内核里阻塞，新的注册不能等到下一次wait再提交
+  void UringReactor::submitIfWaiting()
+  {
+    if (!m_waiting || !m_unsubmitted)
+    {
+      return;
+    }
+    int rt = Enter(m_ringFd, m_unsubmitted, 0, 0);
+    if (rt > 0)
+    {
+      m_unsubmitted -= rt;
+    }
+    else if (rt < 0)
+    {
+      std::cerr << "UringReactor::submit failed: " << strerror(errno) << std::endl;
+    }
+  }
+
+  // 旧的注册还在时先移除，再按新的事件重新注册；old_events由自己记录，参数只用于和epoll保持一致
+  bool UringReactor::update(int fd, void *data, uint32_t /*old_events*/, uint32_t new_events)
+  {
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    if ((size_t)fd >= m_fds.size())
+    {
+      m_fds.resize(std::max((size_t)fd + 1, m_fds.size() * 2));
+    }
+
+    FdState &state = m_fds[fd];
+    if (state.events)
+    {
+      io_uring_sqe *sqe = getSqe();
+      if (!sqe)
+      {
+        return false;
+      }
+      sqe->opcode = IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = UserData(fd, state.seq);
+      sqe->user_data = REMOVE_TAG;
+      CommitSqe(m_sqTail, m_sqArray, m_sqMask);
+      ++m_unsubmitted;
+      state.events = 0;
+    }
+
+    if (new_events)
+    {
+      io_uring_sqe *sqe = getSqe();
+      if (!sqe)
+      {
+        return false;
+      }
+      ++state.seq;
+      state.events = new_events;
+      state.data = data;
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      sqe->poll32_events = new_events;
+      sqe->user_data = UserData(fd, state.seq);
+      CommitSqe(m_sqTail, m_sqArray, m_sqMask);
+      ++m_unsubmitted;
+    }
+
+    submitIfWaiting();
+    return true;
+  }
+
+  int UringReactor::reap(ReadyEvent *events, int max_events, bool &woken)
+  {
+    unsigned head = *m_cqHead;
+    unsigned tail = LoadAcquire(m_cqTail);
+    int n = 0;
+    while (head != tail && n < max_events)
+    {
+      io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+      uint64_t user_data = cqe->user_data;
+      int res = cqe->res;
+      ++head;
+
+      if (user_data == WAKE_TAG)
+      {
+        woken = true;
+        armWake();
+        continue;
+      }
+      if (user_data == TIMEOUT_TAG || user_data == REMOVE_TAG)
+      {
+        continue;
+      }
+
+      // 已经被移除或者重新注册过的完成事件直接丢弃
+      size_t fd = (uint32_t)user_data;
+      uint32_t seq = user_data >> 32;
+      if (fd >= m_fds.size() || !m_fds[fd].events || m_fds[fd].seq != seq)
+      {
+        continue;
+      }
+      FdState &state = m_fds[fd];
+      events[n].data = state.data;
+      // 出错或者fd已经关闭（POLLNVAL）当作错误事件，由调用者转换成读写事件
+      events[n].events = (res < 0 || (res & POLLNVAL)) ? (EPOLLERR | EPOLLHUP) : (uint32_t)res;
+      ++n;
+      state.events = 0; // POLL_ADD只触发一次
+    }
+    StoreRelease(m_cqHead, head);
+    return n;
+  }
+
+  int UringReactor::doWait(ReadyEvent *events, int max_events, int64_t timeout_ns, bool &woken)
+  {
+    std::unique_lock<std::timed_mutex> leader(m_waitMutex, std::defer_lock);
+    if (!leader.try_lock())
+    {
+      // 已经有线程在等待，排队；轮到自己时其它线程刚醒来，可能有新任务，不再阻塞
+      if (!leader.try_lock_for(timeout_ns < 0 ? std::chrono::nanoseconds(std::chrono::seconds(5)) : std::chrono::nanoseconds(timeout_ns)))
+      {
+        return 0;
+      }
+      timeout_ns = 0;
+    }
+
+    unsigned to_submit = 0;
+    bool block = false;
+    {
+      std::lock_guard<std::mutex> lock(m_sqMutex);
+      block = timeout_ns != 0 && *m_cqHead == LoadAcquire(m_cqTail);
+      if (block && timeout_ns > 0)
+      {
+        // 超时也是一个SQE，任何一个完成事件都会让它提前结束
+        io_uring_sqe *sqe = getSqe();
+        if (sqe)
+        {
+          // 超时本身就是纳秒精度
+          m_timeout.tv_sec = timeout_ns / 1000000000;
+          m_timeout.tv_nsec = timeout_ns % 1000000000;
+          sqe->opcode = IORING_OP_TIMEOUT;
+          sqe->fd = -1;
+          sqe->addr = (uint64_t)&m_timeout;
+          sqe->len = 1;
+          sqe->off = 1;
+          sqe->user_data = TIMEOUT_TAG;
+          CommitSqe(m_sqTail, m_sqArray, m_sqMask);
+          ++m_unsubmitted;
+        }
+      }
+      to_submit = m_unsubmitted;
+      m_unsubmitted = 0;
+      m_waiting = block;
+    }
+
+    if (block || to_submit)
+    {
+      int rt = Enter(m_ringFd, to_submit, block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+      unsigned submitted = rt > 0 ? rt : 0;
+      if (rt < 0 && errno != EINTR && errno != ETIME)
+      {
+        std::cerr << "UringReactor::wait io_uring_enter failed: " << strerror(errno) << std::endl;
+      }
+      if (submitted < to_submit)
+      {
+        std::lock_guard<std::mutex> lock(m_sqMutex);
+        m_unsubmitted += to_submit - submitted;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    m_waiting = false;
+    return reap(events, max_events, woken);
+  }
+
+  void UringReactor::doWake()
+  {
+    uint64_t one = 1;
+    int rt = write(m_wakeFd, &one, sizeof(one));
+    (void)rt;
+  }
+}
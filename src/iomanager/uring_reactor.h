@@ -0,0 +1,86 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include "reactor.h"
+
+#include <linux/io_uring.h>
+#include <mutex>
+#include <vector>
+
+namespace colib
+{
+  /*
+   * io_uring后端，直接使用系统调用，不依赖liburing
+   * 事件注册（POLL_ADD/POLL_REMOVE）、超时（TIMEOUT）和唤醒（eventfd上的READ）都作为SQE提交，
+   * 在wait时和等待一起通过一次io_uring_enter提交，完成事件也一次批量收割
+   * 同一时刻只有一个线程在环上等待（Reactor只让leader阻塞等待），poll()和它同时调用时直接返回
+   * POLL_ADD本身就是一次性的，user_data里带有fd和注册序号，旧注册的完成事件直接丢弃
+   */
+  class UringReactor : public Reactor
+  {
+  public:
+    UringReactor(unsigned entries = 1024);
+    ~UringReactor();
+
+    // 内核不支持或者被禁止时为false
+    bool isValid() const { return m_ringFd >= 0; }
+
+    Backend getBackend() const override { return IO_URING; }
+    const char *getName() const override { return "io_uring"; }
+
+    bool update(int fd, void *data, uint32_t old_events, uint32_t new_events) override;
+
+  protected:
+    int doWait(ReadyEvent *events, int max_events, int64_t timeout_ns, bool &woken) override;
+    void doWake() override;
+
+  private:
+    // 每个fd当前的注册，序号用来识别过期的完成事件
+    struct FdState
+    {
+      uint32_t events = 0;
+      uint32_t seq = 0;
+      void *data = nullptr;
+    };
+
+    bool setup(unsigned entries);
+    io_uring_sqe *getSqe();     // 调用者持有m_sqMutex
+    void armWake();             // 调用者持有m_sqMutex
+    void submitIfWaiting();     // 调用者持有m_sqMutex
+    int reap(ReadyEvent *events, int max_events, bool &woken); // 调用者持有m_sqMutex
+
+  private:
+    int m_ringFd = -1;
+    int m_wakeFd = -1;
+    uint64_t m_wakeBuf = 0;        // 唤醒READ的缓冲区，只由内核写
+    __kernel_timespec m_timeout{}; // 超时SQE的参数，只由等待者使用
+
+    // 提交队列
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned *m_sqArray = nullptr;
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    // 完成队列
+    void *m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    std::mutex m_sqMutex;        // 保护提交队列、收割和m_fds
+    unsigned m_unsubmitted = 0;  // 已经放入提交队列还没有交给内核的SQE数
+    bool m_waiting = false;      // 有线程阻塞在io_uring_enter中，新的SQE需要立即提交
+    std::vector<FdState> m_fds;  // 下标为fd
+
+    std::timed_mutex m_waitMutex; // 同一时刻只有一个线程进入环
+  };
+}
+
+#endif
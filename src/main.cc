@@ -11,9 +11,7 @@
 #include <chrono>
 #include <thread>
 
-static int sock_listen_fd = -1;
-
-void test_accept();
+void test_accept(int sock_listen_fd);
 void error(const char *msg)
 {
   perror(msg);
@@ -21,12 +19,14 @@ void error(const char *msg)
   exit(1);
 }
 
-void watch_io_read()
+void watch_io_read(int sock_listen_fd)
 {
-  colib::IOManager::GetThis()->addEvent(sock_listen_fd, colib::IOManager::READ, test_accept);
+  colib::IOManager::GetThis()->addEvent(sock_listen_fd, colib::IOManager::READ, [sock_listen_fd]()
+                                        { test_accept(sock_listen_fd); });
 }
 
-void test_accept()
+// 每个工作线程在自己的监听fd上accept，连接的事件也注册在这个线程上
+void test_accept(int sock_listen_fd)
 {
   struct sockaddr_in addr;
   memset(&addr, 0, sizeof(addr));
@@ -38,7 +38,6 @@ void test_accept()
   }
   else
   {
-    std::cout << "accepted connection, fd = " << fd << std::endl;
     fcntl(fd, F_SETFL, O_NONBLOCK);
     colib::IOManager::GetThis()->addEvent(fd, colib::IOManager::READ, [fd]() {
       char buffer[1024];
@@ -83,48 +82,31 @@ void test_accept()
         }
             } });
   }
-  colib::IOManager::GetThis()->addEvent(sock_listen_fd, colib::IOManager::READ, test_accept);
+  watch_io_read(sock_listen_fd);
 }
 
-void test_iomanager()
+void test_iomanager(size_t threads)
 {
   int portno = 8080;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t client_len = sizeof(client_addr);
-
-  // 设置套接字
-  sock_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock_listen_fd < 0)
-  {
-    error("Error creating socket..\n");
-  }
-
-  int yes = 1;
-  // 解决 "address already in use" 错误
-  setsockopt(sock_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in server_addr;
 
   memset((char *)&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
   server_addr.sin_port = htons(portno);
   server_addr.sin_addr.s_addr = INADDR_ANY;
 
-  // 绑定套接字并监听连接
-  if (bind(sock_listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
-    error("Error binding socket..\n");
-
-  if (listen(sock_listen_fd, 1024) < 0)
+  // 分片模式：每个线程一个epoll，一个SO_REUSEPORT监听fd，由内核分配连接
+  colib::IOManager iom(threads, true, "http", colib::Reactor::EPOLL, true);
+  if (!iom.listenPerWorker((struct sockaddr *)&server_addr, sizeof(server_addr), 1024, watch_io_read))
   {
     error("Error listening..\n");
   }
-
-  printf("epoll echo server listening for connections on port: %d\n", portno);
-  fcntl(sock_listen_fd, F_SETFL, O_NONBLOCK);
-  colib::IOManager iom(9);
-  iom.addEvent(sock_listen_fd, colib::IOManager::READ, test_accept);
+  printf("epoll echo server listening for connections on port: %d, threads: %zu\n", portno, threads);
 }
 
 int main(int argc, char *argv[])
 {
-  test_iomanager();
+  size_t threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  test_iomanager(threads > 0 ? threads : 1);
   return 0;
 }
\ No newline at end of file
@@ -5,16 +5,31 @@ static bool debug = false;
 namespace colib{
   // 当前线程的调度器，同一个调度器下的所有线程指向同一个调度器实例
   static thread_local Scheduler *t_scheduler = nullptr; 
+  // 当前线程在t_scheduler中的工作线程状态，线程进入run()之后才有
+  static thread_local void *t_worker = nullptr;
+
+  // 每处理这么多个任务优先检查一次注入队列，避免本地任务一直不断时外部任务饿死
+  static const uint32_t INJECT_CHECK_INTERVAL = 61;
+  // 每个工作线程最多缓存的空节点数
+  static const size_t FREE_NODE_LIMIT = 1024;
 
   /* 调度器的创建 */
   // 线程数，是否将当前线程作为调度线程
   // caller线程，调用线程，也就是主线程
-  Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name){
+  Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
+      : m_name(name), m_useCaller(use_caller)
+  {
     assert(threads > 0 && Scheduler::GetThis() == nullptr);
 
     SetThis();
     Thread::SetName(m_name);
 
+    // 包括caller线程在内，每个工作线程一个本地队列
+    for (size_t i = 0; i < threads; ++i) {
+      m_workers.emplace_back(new Worker());
+      m_workers.back()->index = i;
+    }
+
     // 主线程参与调度
     if(use_caller){
       threads--;
@@ -24,8 +39,9 @@ namespace colib{
       m_schedulerFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, false));
       Fiber::SetSchedulerFiber(m_schedulerFiber.get());
 
-      m_threadCount = Thread::GetThreadID();
+      m_rootThread = Thread::GetThreadID();
       m_threadIDs.push_back(m_rootThread);
+      m_workers[0]->thread = m_rootThread;
     }
 
     m_threadCount = threads;
@@ -62,9 +78,12 @@ namespace colib{
 
     assert(m_threads.empty());
     m_threads.resize(m_threadCount);
+    // caller线程占用第一个工作线程状态
+    size_t offset = m_useCaller ? 1 : 0;
     for (size_t i = 0; i < m_threadCount;i++){
       m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
       m_threadIDs.push_back(m_threads[i]->getID());
+      m_workers[i + offset]->thread = m_threads[i]->getID();
     }
     if (debug)
       std::cout << "Scheduler::start() success\n";
@@ -80,40 +99,35 @@ namespace colib{
     if (debug)
       std::cout << "Schedule::run() starts in thread: " << thread_id << std::endl;
     SetThis();
+    onThreadStart();
     // 如果当前线程不为主线程，那么需要创建
     if(thread_id!=m_rootThread){
       Fiber::GetThis();
     }
 
+    // 找到本线程的工作线程状态，start()持有锁直到所有线程都登记完
+    Worker *worker = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      worker = findWorker(thread_id);
+    }
+    assert(worker);
+    worker->seed = (uint32_t)thread_id * 2654435761u + 1;
+    t_worker = worker;
+
     // idle coroutine 这个线程为什么类似于一直处于忙等的状态
     std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
     ScheduleTask task;
+    // 本线程执行完毕的回调协程，reset后复用，省去每个回调任务的协程创建和栈分配
+    std::vector<std::shared_ptr<Fiber>> fiber_pool;
+    fiber_pool.reserve(m_fiberPoolSize.load(std::memory_order_relaxed));
 
     while (true)
     {
       task.reset();
       bool tickle_me = false;
 
-      {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        auto it = m_tasks.begin();
-        // 遍历任务队列
-        while(it!=m_tasks.end()){
-          if(it->thread!=-1&&it->thread!=thread_id){
-            it++;
-            tickle_me = true;
-            continue;
-          }
-
-          // 取出任务
-          assert(it->fiber || it->cb);
-          task = *it;
-          m_tasks.erase(it);
-          m_activeThreadCount++;
-          break;
-        }
-        tickle_me = tickle_me || (it != m_tasks.end());
-      }
+      dequeue(worker, task, tickle_me);
       // ...?
       if(tickle_me){
         tickle();
@@ -130,13 +144,35 @@ namespace colib{
         m_activeThreadCount--;
         task.reset();
       }else if(task.cb){
-        std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
+        bool shared_stack = m_sharedStack.load(std::memory_order_relaxed);
+        std::shared_ptr<Fiber> cb_fiber;
+        while (!fiber_pool.empty() && !cb_fiber)
+        {
+          cb_fiber = std::move(fiber_pool.back());
+          fiber_pool.pop_back();
+          // setSharedStack()可能在运行中被修改，模式不符的直接丢弃
+          if (cb_fiber->isSharedStack() != shared_stack)
+          {
+            cb_fiber.reset();
+          }
+        }
+        if (cb_fiber) {
+          cb_fiber->reset(std::move(task.cb));
+        } else {
+          cb_fiber = std::make_shared<Fiber>(std::move(task.cb), 0, true, shared_stack);
+        }
         {
           std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
           cb_fiber->resume();
         }
         m_activeThreadCount--;
         task.reset();
+
+        // 执行完且没有别人持有的协程放回池中；挂起的协程由等待它的一方持有
+        if (cb_fiber->getState() == Fiber::TERM && cb_fiber.use_count() == 1 &&
+            fiber_pool.size() < m_fiberPoolSize.load(std::memory_order_relaxed)) {
+          fiber_pool.push_back(std::move(cb_fiber));
+        }
       }else{
         // 没有任务，执行空闲协程
         // 系统关闭 -> idle协程将从死循环跳出并结束 -> 
@@ -144,6 +180,7 @@ namespace colib{
         if(idle_fiber->getState()==Fiber::TERM){ // 也会退出整个调度
           if (debug)
             std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
+          t_worker = nullptr;
           break;
         }
         m_idleThreadCount++;
@@ -153,6 +190,211 @@ namespace colib{
     }
   }
 
+  /* 任务的入队和出队 */
+  // 指定了线程的任务放入目标线程的信箱，工作线程提交的其它任务放入自己的本地队列，
+  // 其余的放入注入队列
+  void Scheduler::enqueue(ScheduleTask &task) {
+    Worker *worker = t_scheduler == this ? (Worker *)t_worker : nullptr;
+    bool need_tickle = false;
+    ++m_taskCount;
+
+    // 不属于本调度器的线程号仍然放入注入队列，和原来的行为一致
+    Worker *target = task.thread == -1 ? nullptr : findWorker(task.thread);
+    if (target) {
+      {
+        std::lock_guard<std::mutex> lock(target->mailboxMutex);
+        if (target->mailboxFree.empty()) {
+          target->mailbox.push_back(std::move(task));
+        } else {
+          target->mailbox.splice(target->mailbox.end(), target->mailboxFree, target->mailboxFree.begin());
+          target->mailbox.back() = std::move(task);
+        }
+        ++target->mailboxCount;
+      }
+      if (target != worker) {
+        tickleThread(target->thread);
+      }
+    } else if (worker && task.thread == -1) {
+      pushLocal(worker, task);
+      // 自己稍后会执行，有空闲线程时叫醒一个来窃取
+      need_tickle = hasIdleThreads();
+    } else {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      need_tickle = m_tasks.empty();
+      pushInjected(task);
+    }
+
+    if (need_tickle) {
+      tickle(); // 唤醒idle协程
+    }
+  }
+
+  void Scheduler::pushLocal(Worker *worker, ScheduleTask &task) {
+    ScheduleTask *node = nullptr;
+    if (worker->freeNodes.empty()) {
+      node = new ScheduleTask();
+    } else {
+      node = worker->freeNodes.back();
+      worker->freeNodes.pop_back();
+    }
+    *node = std::move(task);
+    worker->queue.push(node);
+  }
+
+  void Scheduler::pushInjected(ScheduleTask &task) {
+    // 优先复用已经出队的链表节点，避免每次入队都分配
+    if (m_freeTasks.empty()) {
+      m_tasks.push_back(std::move(task));
+    } else {
+      m_tasks.splice(m_tasks.end(), m_freeTasks, m_freeTasks.begin());
+      m_tasks.back() = std::move(task);
+    }
+    ++m_injectedCount;
+  }
+
+  /* 批量调度 */
+  void Scheduler::beginBatch(Batch &batch) {
+    batch.worker = t_scheduler == this ? (Worker *)t_worker : nullptr;
+    batch.count = 0;
+  }
+
+  void Scheduler::addToBatch(Batch &batch, ScheduleTask &task) {
+    // 信箱不需要m_mutex，可以直接走单个任务的路径
+    if (task.thread != -1 && findWorker(task.thread)) {
+      enqueue(task);
+      return;
+    }
+
+    ++m_taskCount;
+    if (batch.worker && task.thread == -1) {
+      pushLocal(batch.worker, task);
+    } else {
+      if (!batch.lock.owns_lock()) {
+        batch.lock = std::unique_lock<std::mutex>(m_mutex);
+      }
+      pushInjected(task);
+    }
+    ++batch.count;
+  }
+
+  void Scheduler::endBatch(Batch &batch) {
+    if (batch.lock.owns_lock()) {
+      batch.lock.unlock();
+    }
+    size_t n = std::min(batch.count, getIdleThreadCount());
+    for (size_t i = 0; i < n; ++i) {
+      tickle();
+    }
+  }
+
+  // 依次尝试信箱、本地队列、注入队列和其它线程的队列
+  bool Scheduler::dequeue(Worker *worker, ScheduleTask &task, bool &tickle_me) {
+    if (++worker->tick % INJECT_CHECK_INTERVAL == 0 && takeInjected(worker->thread, task, tickle_me)) {
+      return true;
+    }
+    if (takeMailbox(worker, task)) {
+      return true;
+    }
+    if (takeNode(worker, worker->queue, task)) {
+      return true;
+    }
+    if (takeInjected(worker->thread, task, tickle_me)) {
+      return true;
+    }
+
+    // 从随机位置开始，每个线程窃取一次
+    size_t n = m_workers.size();
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+    size_t start = worker->seed % n;
+    for (size_t i = 0; i < n; ++i) {
+      Worker *victim = m_workers[(start + i) % n].get();
+      if (victim != worker && takeNode(worker, victim->queue, task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 注入队列中可能有指定给未知线程的任务，跳过它们并通知其它线程
+  bool Scheduler::takeInjected(int thread_id, ScheduleTask &task, bool &tickle_me) {
+    if (m_injectedCount == 0) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tasks.begin();
+    // 遍历任务队列
+    while(it!=m_tasks.end()){
+      if(it->thread!=-1&&it->thread!=thread_id){
+        it++;
+        tickle_me = true;
+        continue;
+      }
+
+      // 取出任务
+      assert(it->fiber || it->cb);
+      task = std::move(*it);
+      it->reset();
+      m_freeTasks.splice(m_freeTasks.end(), m_tasks, it++);
+      --m_injectedCount;
+      m_activeThreadCount++;
+      --m_taskCount;
+      tickle_me = tickle_me || (it != m_tasks.end());
+      return true;
+    }
+    return false;
+  }
+
+  bool Scheduler::takeMailbox(Worker *worker, ScheduleTask &task) {
+    if (worker->mailboxCount == 0) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(worker->mailboxMutex);
+    if (worker->mailbox.empty()) {
+      return false;
+    }
+    auto it = worker->mailbox.begin();
+    task = std::move(*it);
+    it->reset();
+    worker->mailboxFree.splice(worker->mailboxFree.end(), worker->mailbox, it);
+    --worker->mailboxCount;
+    m_activeThreadCount++;
+    --m_taskCount;
+    return true;
+  }
+
+  // 线程数量很少，直接遍历
+  Scheduler::Worker *Scheduler::findWorker(int thread) {
+    for (auto &worker : m_workers) {
+      if (worker->thread == thread) {
+        return worker.get();
+      }
+    }
+    return nullptr;
+  }
+
+  // 从本地或者其它线程的队列取出一个任务，节点回收到当前线程
+  bool Scheduler::takeNode(Worker *worker, WorkStealingQueue<ScheduleTask *> &queue, ScheduleTask &task) {
+    ScheduleTask *node = nullptr;
+    if (!queue.steal(node)) {
+      return false;
+    }
+
+    m_activeThreadCount++;
+    --m_taskCount;
+    task = std::move(*node);
+    node->reset();
+    if (worker->freeNodes.size() < FREE_NODE_LIMIT) {
+      worker->freeNodes.push_back(node);
+    } else {
+      delete node;
+    }
+    return true;
+  }
+
   /* 调度器的停止*/
   // 调度器的stop，有caller）（待归纳）
   void Scheduler::stop() {
@@ -168,7 +410,8 @@ namespace colib{
     if (m_useCaller) {
       assert(GetThis() == this);
     } else {
-      assert(GetThis() != this);
+      // 创建调度器的线程也绑定了调度器，只要求不在工作线程中停止
+      assert(getWorkerIndex() < 0);
     }
 
     for (size_t i = 0; i < m_threadCount; i++) {
@@ -199,18 +442,129 @@ namespace colib{
       std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadID() << std::endl;
   }
 
+  // 出队时先增加活跃线程数再减少任务数，两者同时为0说明确实没有任务了
   bool Scheduler::stopping(){
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
   }
 
-  // 
+  /* 空闲线程的睡眠和唤醒 */
+  static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  // 先自旋一段时间等新任务，仍然没有再睡眠在futex上（std::atomic::wait），
+  // 入队时只唤醒一个睡眠的线程
   void Scheduler::idle() {
+    Worker *worker = (Worker *)t_worker;
     while(!stopping()){
-      if (debug)
-        std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadID() << std::endl;
-      sleep(1);
+      uint32_t spin = 0;
+      uint32_t spin_count = m_idleSpinCount.load(std::memory_order_relaxed);
+      while (spin < spin_count && !hasWork(worker) && !stopping()) {
+        CpuRelax();
+        ++spin;
+      }
+      if (spin == spin_count) {
+        if (debug)
+          std::cout << "Scheduler::idle(), parking in thread: " << Thread::GetThreadID() << std::endl;
+        park(worker);
+      }
       Fiber::GetThis()->yield();
     }
+    // 本线程退出时其它线程可能还在睡眠，叫醒它们检查是否可以停止
+    unparkAll();
+  }
+
+  // 信箱、注入队列或者任何线程的本地队列里有任务
+  bool Scheduler::hasWork(Worker *worker) {
+    if (worker->mailboxCount || m_injectedCount) {
+      return true;
+    }
+    for (auto &w : m_workers) {
+      if (!w->queue.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool Scheduler::hasReadyTask() {
+    Worker *worker = t_scheduler == this ? (Worker *)t_worker : nullptr;
+    return worker ? hasWork(worker) : m_taskCount > 0;
+  }
+
+  // caller线程在进入run()之前也算作0号工作线程
+  int Scheduler::getWorkerIndex() {
+    if (t_scheduler != this) {
+      return -1;
+    }
+    Worker *worker = t_worker ? (Worker *)t_worker : findWorker(Thread::GetThreadID());
+    return worker ? (int)worker->index : -1;
+  }
+
+  int Scheduler::getRunningWorkerIndex() {
+    if (t_scheduler != this || !t_worker) {
+      return -1;
+    }
+    return (int)((Worker *)t_worker)->index;
+  }
+
+  int Scheduler::getWorkerIndex(int thread) {
+    Worker *worker = findWorker(thread);
+    return worker ? (int)worker->index : -1;
+  }
+
+  // 先登记睡眠再检查一次任务，和入队后检查睡眠线程数配对，不会丢失唤醒
+  void Scheduler::park(Worker *worker) {
+    worker->parked = 1;
+    ++m_parkedCount;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (hasWork(worker) || stopping()) {
+      if (worker->parked.exchange(0) == 1) {
+        --m_parkedCount;
+      }
+      return;
+    }
+    worker->parked.wait(1);
+  }
+
+  bool Scheduler::unpark(Worker *worker) {
+    uint32_t expected = 1;
+    if (!worker->parked.compare_exchange_strong(expected, 0)) {
+      return false;
+    }
+    --m_parkedCount;
+    worker->parked.notify_one();
+    return true;
+  }
+
+  void Scheduler::unparkAll() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto &worker : m_workers) {
+      unpark(worker.get());
+    }
+  }
+
+  void Scheduler::tickle() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parkedCount == 0) {
+      return;
+    }
+    for (auto &worker : m_workers) {
+      if (unpark(worker.get())) {
+        return;
+      }
+    }
+  }
+
+  void Scheduler::tickleThread(int thread) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Worker *worker = findWorker(thread);
+    if (worker) {
+      unpark(worker);
+    }
   }
-}
\ No newline at end of file
+}
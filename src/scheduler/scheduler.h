@@ -4,12 +4,21 @@
 #include <vector>
 #include <mutex>
 #include <list>
+#include <atomic>
+#include <memory>
+#include <iterator>
 #include "../fiber/fiber.h"
 #include "../thread/thread.h"
+#include "../util/callback.h"
+#include "../util/work_stealing_queue.h"
 
   // 简单调度类，支持添加调度任务以及运行调度任务
   /*
   * FIFO
+  * 任务队列：
+  ** 每个工作线程有自己的无锁队列，线程内产生的任务放入本地队列，空闲时随机窃取其它线程的任务
+  ** 非工作线程提交的任务放入全局注入队列
+  ** 指定了线程的任务直接放入目标线程的信箱，只唤醒目标线程
   * 多线程：
   ** 一个线程同时只能运行一个协程，所以
   ** 多线程意味着多个协程可以同时执行
@@ -29,6 +38,14 @@ namespace colib{
 
       const std::string &getName() const { return m_name; }
 
+      // 以下参数运行中也可以修改，工作线程下次读取时生效
+      // 回调任务的协程是否运行在线程的共享栈上，适合大量长时间挂起的协程
+      void setSharedStack(bool on) { m_sharedStack.store(on, std::memory_order_relaxed); }
+      // 每个工作线程最多缓存多少个执行完毕的回调协程用于复用
+      void setFiberPoolSize(size_t size) { m_fiberPoolSize.store(size, std::memory_order_relaxed); }
+      // 空闲线程睡眠前自旋检查任务的次数，0表示直接睡眠
+      void setIdleSpinCount(uint32_t count) { m_idleSpinCount.store(count, std::memory_order_relaxed); }
+
     public:
       static Scheduler *GetThis();  // 获取正在运行的调度器
       static Fiber *GetMainFiber(); // 获取当前线程的主协程
@@ -36,22 +53,42 @@ namespace colib{
     public:
       template<class FiberOrCb> // 协程对象or指针，线程号
       void scheduleLock(FiberOrCb fc,int thread=-1){
-        bool need_tickle = false;
+        ScheduleTask task(std::move(fc), thread);
+        // 共享栈协程只能回到绑定的线程执行，指定了其它线程也一样
+        if (task.fiber && task.fiber->getThread() != -1)
+        {
+          task.thread = task.fiber->getThread();
+        }
+        if (task.fiber || task.cb)
         {
-          std::lock_guard<std::mutex> lock(m_mutex);
-          need_tickle = m_tasks.empty();
+          enqueue(task);
+        }
+      }
 
-          ScheduleTask task(fc, thread);
+      // 批量调度，元素会被移走；注入队列只加一次锁，最后唤醒min(任务数, 空闲线程数)个线程
+      // 指定了线程的任务仍然逐个放入目标线程的信箱，共享栈协程总是放入绑定线程的信箱
+      template<class Iter>
+      void scheduleBatch(Iter first, Iter last, int thread = -1){
+        Batch batch;
+        beginBatch(batch);
+        for (; first != last; ++first)
+        {
+          ScheduleTask task(std::move(*first), thread);
+          if (task.fiber && task.fiber->getThread() != -1)
+          {
+            task.thread = task.fiber->getThread();
+          }
           if (task.fiber || task.cb)
           {
-            m_tasks.push_back(task);
+            addToBatch(batch, task);
           }
         }
+        endBatch(batch);
+      }
 
-        if (need_tickle)
-        {
-          tickle(); // 唤醒idle协程
-        }
+      template<class Range>
+      void scheduleBatch(Range &&range, int thread = -1){
+        scheduleBatch(std::begin(range), std::end(range), thread);
       }
 
       void start();
@@ -60,22 +97,34 @@ namespace colib{
     protected:
       void SetThis(); // 设置正在运行的调度器
 
-      virtual void tickle() {}; // 通知协程调度器有任务了
+      virtual void tickle();                 // 通知协程调度器有任务了，唤醒一个睡眠的线程
+      virtual void tickleThread(int thread); // 通知指定线程有任务了
       void run();               // 协程调度函数
       virtual void idle();      // 无任务执行idle协程
+      virtual void onThreadStart() {} // 工作线程进入run()时调用
 
       virtual bool stopping();                                // 是否可以停止
       bool hasIdleThreads() { return m_idleThreadCount > 0; } // 是否有空闲协程
+      size_t getIdleThreadCount() { return m_idleThreadCount; } // 空闲线程数
+      bool hasReadyTask();                                      // 当前线程睡眠前检查是否还有可执行的任务
+
+      // 工作线程包括caller线程，下标从0开始，在调度器的生命周期内不变
+      size_t getWorkerCount() const { return m_workers.size(); }
+      int getWorkerIndex();           // 当前线程的工作线程下标，不是本调度器的线程返回-1
+      int getRunningWorkerIndex();    // 同上，但只在run()中才算，caller线程在进入run()之前返回-1
+      int getWorkerIndex(int thread); // 指定线程的工作线程下标
+      int getWorkerThread(size_t index) { return m_workers[index]->thread; } // start()之后才有效
+      bool isUseCaller() const { return m_useCaller; } // caller线程是0号工作线程，stop()时才进入run()
 
     private:
       // 调度任务，协程or函数
       struct ScheduleTask{
         std::shared_ptr<Fiber> fiber;
-        std::function<void()> cb; // callback
+        Callback cb; // callback
         int thread;
 
         ScheduleTask(std::shared_ptr<Fiber> f,int thr) {
-          fiber = f;
+          fiber = std::move(f);
           thread = thr;
         }
 
@@ -84,17 +133,24 @@ namespace colib{
           thread = thr;
         }
 
-        ScheduleTask(std::function<void()> f, int thr) {
-          cb = f;
+        ScheduleTask(Callback f, int thr) {
+          cb = std::move(f);
           thread = thr;
         }
 
-        ScheduleTask(std::function<void()> *f, int thr)
+        ScheduleTask(Callback *f, int thr)
         {
           cb.swap(*f);
           thread = thr;
         }
 
+        ScheduleTask(std::function<void()> *f, int thr)
+        {
+          cb = std::move(*f);
+          *f = nullptr;
+          thread = thr;
+        }
+
         ScheduleTask() {
           fiber = nullptr;
           cb = nullptr;
@@ -108,12 +164,66 @@ namespace colib{
         }
       };
 
+      // 工作线程的本地状态，queue和信箱会被其它线程访问
+      struct Worker{
+        size_t index = 0;                        // 在m_workers中的下标
+        WorkStealingQueue<ScheduleTask *> queue; // 本地任务队列
+        std::vector<ScheduleTask *> freeNodes;   // 出队后留下的空节点
+        std::atomic<int> thread = {-1};          // 所在线程id
+        uint32_t tick = 0;                       // 调度次数，用于定期检查注入队列
+        uint32_t seed = 0;                       // 选择窃取目标的随机数状态
+
+        // 信箱，只能由本线程执行的任务
+        std::mutex mailboxMutex;
+        std::list<ScheduleTask> mailbox;
+        std::list<ScheduleTask> mailboxFree;      // 信箱出队后留下的空节点
+        std::atomic<size_t> mailboxCount = {0};
+
+        std::atomic<uint32_t> parked = {0}; // 1表示在idle中睡眠，唤醒者置0后notify
+
+        ~Worker(){
+          for (ScheduleTask *node : freeNodes) {
+            delete node;
+          }
+        }
+      };
+
+      // 一次批量调度的状态
+      struct Batch{
+        Worker *worker = nullptr;          // 当前线程的工作线程状态
+        std::unique_lock<std::mutex> lock; // 注入队列的锁，第一个任务放入注入队列时加锁
+        size_t count = 0;                  // 放入本地队列和注入队列的任务数
+      };
+
+      void beginBatch(Batch &batch);
+      void addToBatch(Batch &batch, ScheduleTask &task);
+      void endBatch(Batch &batch);
+
+      void enqueue(ScheduleTask &task);
+      void pushLocal(Worker *worker, ScheduleTask &task);
+      void pushInjected(ScheduleTask &task); // 调用者持有m_mutex
+      bool dequeue(Worker *worker, ScheduleTask &task, bool &tickle_me);
+      bool takeInjected(int thread_id, ScheduleTask &task, bool &tickle_me);
+      bool takeMailbox(Worker *worker, ScheduleTask &task);
+      Worker *findWorker(int thread);
+
+      // 基础调度器的空闲线程睡眠和唤醒
+      bool hasWork(Worker *worker);
+      void park(Worker *worker);
+      bool unpark(Worker *worker);
+      void unparkAll();
+      bool takeNode(Worker *worker, WorkStealingQueue<ScheduleTask *> &queue, ScheduleTask &task);
+
       private:
         std::string m_name; // 协程调度器名称
 
         std::mutex m_mutex;                             // 互斥锁
         std::vector<std::shared_ptr<Thread>> m_threads; // 线程池
-        std::list<ScheduleTask> m_tasks;                // 任务队列
+        std::list<ScheduleTask> m_tasks;                // 注入队列，非工作线程提交的任务
+        std::list<ScheduleTask> m_freeTasks;            // 注入队列出队后留下的空节点
+        std::atomic<size_t> m_injectedCount = {0};      // 注入队列中的任务数，无锁判断是否为空
+        std::vector<std::unique_ptr<Worker>> m_workers; // 每个工作线程一个
+        std::atomic<size_t> m_taskCount = {0};          // 所有队列中的任务总数
         std::vector<int> m_threadIDs;                   // 线程池的ID数组
 
         size_t m_threadCount = 0; // 工作线程数量
@@ -124,7 +234,11 @@ namespace colib{
         std::shared_ptr<Fiber> m_schedulerFiber; // 额外创建调度协程
         int m_rootThread = -1;                   // 主线程的线程id
 
-        bool m_stopping = false; // 是否正在关闭
+        std::atomic<bool> m_stopping = {false}; // 是否正在关闭
+        std::atomic<bool> m_sharedStack = {false};      // 回调协程是否使用共享栈
+        std::atomic<size_t> m_fiberPoolSize = {64};     // 每个线程复用的回调协程上限
+        std::atomic<uint32_t> m_idleSpinCount = {2000}; // 空闲线程睡眠前的自旋次数
+        std::atomic<size_t> m_parkedCount = {0}; // 睡眠中的线程数
   };
 }
 
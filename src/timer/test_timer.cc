@@ -7,9 +7,10 @@ void func(int i){
   std::cout << "i: " << i << std::endl;
 }
 
-int main(){
-  std::shared_ptr<TimerManager> manager(new TimerManager());
-  std::vector<std::function<void()>> cbs;
+// 带任意参数运行时测试时间轮
+int main(int argc, char **argv){
+  std::shared_ptr<TimerManager> manager(new TimerManager(argc > 1 ? TimerManager::WHEEL : TimerManager::HEAP));
+  std::vector<Callback> cbs;
 
   // list expired cb
   {
@@ -22,7 +23,7 @@ int main(){
     manager->listExpiredCb(cbs);
     while (!cbs.empty())
     {
-      std::function<void()> cb = *cbs.begin();
+      Callback cb = std::move(*cbs.begin());
       cbs.erase(cbs.begin());
       cb();
     }
@@ -32,7 +33,7 @@ int main(){
 
     while (!cbs.empty())
     {
-      std::function<void()> cb = *cbs.begin();
+      Callback cb = std::move(*cbs.begin());
       cbs.erase(cbs.begin());
       cb();
     }
@@ -45,11 +46,24 @@ int main(){
     while(j-- > 0){
       sleep(1);
       manager->listExpiredCb(cbs);
-      std::function<void()> cb = *cbs.begin();
+      Callback cb = std::move(*cbs.begin());
       cbs.erase(cbs.begin());
       cb();
     }
   }
 
+  // intrusive node
+  {
+    TimerNode a(std::bind(&func, 2000)), b(std::bind(&func, 2001));
+    TimerHandle ha = manager->arm(a, std::chrono::milliseconds(500));
+    TimerHandle hb = manager->arm(b, std::chrono::milliseconds(500));
+    std::cout << "cancel b: " << manager->cancel(hb) << std::endl;
+    sleep(1);
+    manager->runExpiredNodes();
+    // 到期和取消之后句柄都已经失效
+    std::cout << "stale cancel: " << manager->cancel(ha) << manager->cancel(hb)
+              << " refresh: " << manager->refresh(ha, std::chrono::milliseconds(1)) << std::endl;
+  }
+
   return 0;
 }
@@ -1,174 +1,375 @@
 #include "timer.h"
+#include "../scheduler/scheduler.h"
+
+#include <time.h>
 
 namespace colib
 {
   /* Timer*/
 
   bool Timer::cancel() {
+    if(m_queue >= 0){
+      return m_manager->cancelQueued(this);
+    }
     std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
 
     // 将回调函数设置为空
-    if(m_cb==nullptr){
+    if(m_cb==nullptr && !m_fiber){
       return false;
     }else{
       m_cb = nullptr;
+      m_fiber = nullptr;
     }
 
     // 将定时器管理器中的该定时器删除
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it!=m_manager->m_timers.end()){
-      m_manager->m_timers.erase(it);
-    }
+    m_manager->removeFrom(m_manager->m_shared, this);
     return true;
   }
 
   // refresh 只会向后调整
   bool Timer::refresh() {
+    if(m_queue >= 0){
+      return m_manager->rescheduleQueued(this, -1, m_manager->now().time_since_epoch().count());
+    }
     std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
 
-    if(m_cb==nullptr){
+    if(m_cb==nullptr && !m_fiber){
       return false;
     }
 
     // 删除管理中的原定时器，重新添加，这里采用了共享锁的机制，也在访问共享资源时采用了独占锁
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it==m_manager->m_timers.end()){
+    if(!m_manager->removeFrom(m_manager->m_shared, this)){
       return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms);
-    m_manager->m_timers.insert(shared_from_this());
+    m_next = m_manager->now() + m_period;
+    m_manager->insertInto(m_manager->m_shared, shared_from_this());
     return true;
   }
 
   // 重置定时器周期
   bool Timer::reset(uint64_t ms, bool from_now) {
-    if(ms==m_ms&&!from_now){
+    return reset(std::chrono::milliseconds(ms), from_now);
+  }
+
+  bool Timer::reset(std::chrono::nanoseconds period, bool from_now) {
+    if(m_queue >= 0){
+      return m_manager->rescheduleQueued(this, period.count(),
+                                         from_now ? m_manager->now().time_since_epoch().count() : KEEP_START);
+    }
+    if(period==m_period&&!from_now){
       return true;
     }
 
     {
       std::unique_lock<std::shared_mutex> wirte_lock(m_manager->m_mutex);
-      if(!m_cb){
+      if(!m_cb && !m_fiber){
         return false;
       }
 
-      auto it = m_manager->m_timers.find(shared_from_this());
-      if(it==m_manager->m_timers.end()){
+      if(!m_manager->removeFrom(m_manager->m_shared, this)){
         return false;
       }
-      m_manager->m_timers.erase(it);
     }
 
     // 重置周期
-    auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms);
-    m_ms = ms;
-    m_next = start + std::chrono::milliseconds(m_ms);
+    auto start = from_now ? m_manager->now() : m_next - m_period;
+    m_period = period;
+    m_next = start + m_period;
     m_manager->addTimer(shared_from_this());
     return true;
   }
 
-  Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
-                  : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) {
-    auto now = std::chrono::system_clock::now();
-    m_next = now + std::chrono::milliseconds(m_ms);
+  Timer::Timer(std::chrono::nanoseconds period, Callback cb, bool recurring, TimerManager *manager)
+                  : m_recurring(recurring), m_period(period), m_cb(std::move(cb)),
+                    m_slack(manager->m_slack.load(std::memory_order_relaxed)), m_manager(manager) {
+    m_next = manager->now() + m_period;
   }
 
   bool Timer::Comparator::operator()(const std::shared_ptr<Timer> &lhs, const std::shared_ptr<Timer> &rhs) const{
     assert(lhs != nullptr && rhs != nullptr);
-    return lhs->m_next < rhs->m_next;
+    // 超时时间相同的定时器按地址区分，否则set会把它们当成同一个
+    if(lhs->m_next != rhs->m_next){
+      return lhs->m_next < rhs->m_next;
+    }
+    return lhs.get() < rhs.get();
   }
 
   /* Time manager */
 
-  TimerManager::TimerManager() {
-    m_previouseTime = std::chrono::system_clock::now();
+  TimerManager::TimerManager(Queue queue) : m_queueType(queue) {
+    if(queue == WHEEL){
+      m_shared.wheel.reset(new TimingWheel(now()));
+    }
+  }
+
+  // 收件箱中的定时器持有自己的引用，析构前释放；还在arm的节点和管理器脱离
+  TimerManager::~TimerManager() {
+    for(TimerNode *node : m_nodeHeap){
+      node->m_manager = nullptr;
+      node->m_slot = ~0u;
+      node->m_heapIndex = ~0u;
+    }
+    for(size_t i = 0; i < m_threadQueueCount; ++i){
+      Timer *t = m_threadQueueStorage[i].inbox.exchange(nullptr);
+      while(t){
+        Timer *next = t->m_postNext;
+        std::shared_ptr<Timer> hold = std::move(t->m_postHold);
+        t = next;
+      }
+    }
+  }
+
+  void TimerManager::setThreadQueues(size_t count, size_t first) {
+    if(m_threadQueues.load() || first >= count){
+      return;
+    }
+    m_threadQueueStorage.reset(new ThreadQueue[count]);
+    for(size_t i = 0; i < count; ++i){
+      if(m_queueType == WHEEL){
+        m_threadQueueStorage[i].wheel.reset(new TimingWheel(now()));
+      }
+    }
+    m_threadQueueCount = count;
+    m_firstPostQueue = first;
+    m_threadQueues.store(m_threadQueueStorage.get());
   }
 
-  TimerManager::~TimerManager() {}
+  std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, Callback cb, bool recurring)
+  {
+    return addTimer(std::chrono::milliseconds(ms), std::move(cb), recurring);
+  }
 
-  std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+  std::shared_ptr<Timer> TimerManager::addTimer(std::chrono::nanoseconds period, Callback cb, bool recurring)
   {
-    std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
+    std::shared_ptr<Timer> timer = newTimer(period, std::move(cb), recurring);
     addTimer(timer);
     return timer;
   }
 
-  // 如果条件存在 -> 执行cb()
-  static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp){
-      cb();
+  std::shared_ptr<Timer> TimerManager::newTimer(std::chrono::nanoseconds period, Callback cb, bool recurring)
+  {
+    // 循环定时器每次到期都要交出一份回调，把目标放到共享的holder里，保证clone()总是可用
+    if (recurring && cb && !cb.copyable())
+    {
+      cb = [holder = std::make_shared<Callback>(std::move(cb))]()
+      { (*holder)(); };
     }
+    return std::shared_ptr<Timer>(new Timer(period, std::move(cb), recurring, this));
   }
 
-  std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring){
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+  // 如果条件存在 -> 执行cb()
+  std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, Callback cb, std::weak_ptr<void> weak_cond, bool recurring){
+    return addConditionTimer(std::chrono::milliseconds(ms), std::move(cb), std::move(weak_cond), recurring);
   }
 
-  // 找到最近的超时时间
-  uint64_t TimerManager::getNextTimer() {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+  std::shared_ptr<Timer> TimerManager::addConditionTimer(std::chrono::nanoseconds period, Callback cb, std::weak_ptr<void> weak_cond, bool recurring){
+    return addTimer(period, [weak_cond, cb = std::move(cb)]() mutable {
+      std::shared_ptr<void> tmp = weak_cond.lock();
+      if(tmp){
+        cb();
+      }
+    }, recurring);
+  }
 
-    // 重置
-    m_tickled = false;
+  std::shared_ptr<Timer> TimerManager::addFiberTimer(std::chrono::nanoseconds timeout, std::shared_ptr<Fiber> fiber){
+    std::shared_ptr<Timer> timer(new Timer(timeout, nullptr, false, this));
+    timer->m_fiber = std::move(fiber);
+    addTimer(timer);
+    return timer;
+  }
 
-    if(m_timers.empty()){
+  std::shared_ptr<Timer> TimerManager::addInlineTimer(std::chrono::nanoseconds period, Callback cb, bool recurring){
+    std::shared_ptr<Timer> timer = newTimer(period, std::move(cb), recurring);
+    timer->m_inline = true;
+    addTimer(timer);
+    return timer;
+  }
+
+  // 向上取整：向下取整时不足一毫秒的定时器会让epoll_wait以0超时空转到定时器到期
+  uint64_t TimerManager::getNextTimer() {
+    uint64_t ns = getNextTimerNs();
+    if(ns == ~0ull){
       return ~0ull;
     }
+    return (ns + 999999) / 1000000;
+  }
+
+  // 找到最近的超时时间
+  uint64_t TimerManager::getNextTimerNs() {
+    Clock::time_point time;
+    bool has = false;
+    std::atomic<int64_t> *armed = &m_armed; // 侵入式定时器由这个等待时间所属的线程执行
+    if(ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire)){
+      int index = currentTimerQueue();
+      if(index < 0){
+        return ~0ull;
+      }
+      // 先公布等待到的时间再检查一次收件箱，和投递者先放入收件箱再读取等待时间配对，
+      // 投递者看到的要么是新的等待时间，要么它投递的定时器在这里被处理
+      ThreadQueue &queue = queues[index];
+      do{
+        drainInbox(queue);
+        has = nextWake(queue, time);
+        queue.armed.store(has ? time.time_since_epoch().count() : INT64_MAX);
+      }while(queue.inbox.load());
+      armed = index == (int)m_firstPostQueue ? &queue.armed : nullptr;
+    }else{
+      std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+
+      // 重置
+      m_tickled = false;
+
+      has = nextWake(m_shared, time);
+      m_armed.store(has ? time.time_since_epoch().count() : INT64_MAX);
+    }
 
-    auto now = std::chrono::system_clock::now();
-    auto time = (*m_timers.begin())->m_next;
+    // 先公布上面的等待时间再读取节点数，和arm先加入节点再读取等待时间配对：
+    // 这里没有看到的节点，arm时一定看到了不包含它的等待时间
+    if(armed && m_nodeCount.load()){
+      std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+      Clock::time_point node_time;
+      if(nodeWake(node_time) && (!has || node_time < time)){
+        time = node_time;
+        has = true;
+        armed->store(time.time_since_epoch().count());
+      }
+    }
+    if(!has){
+      return ~0ull;
+    }
 
+    Clock::time_point now = loopNow();
     if(now>=time){
       // 已经超时
       return 0;
     }else{
       // 返回剩余时间
-      auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(time - now);
+      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(time - now);
       return static_cast<uint64_t>(duration.count());
     }
   }
 
-  // 取出所有超时定时器的回调函数
-  void TimerManager::listExpiredCb(std::vector<std::function<void()>> &cbs) {
-    auto now = std::chrono::system_clock::now();
-    std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-    
-    bool rollover = detectClockRollover(); // 检测时间是否回滚
+  // 转换出的回调要在调度器的线程中执行
+  void TimerManager::listExpiredCb(std::vector<Callback> &cbs) {
+    std::vector<std::shared_ptr<Fiber>> fibers;
+    listExpired(cbs, fibers, cbs);
+    for(auto &fiber : fibers){
+      cbs.push_back([fiber = std::move(fiber)]() mutable {
+        Scheduler::GetThis()->scheduleLock(std::move(fiber));
+      });
+    }
+  }
 
-    // 定时器不为空，rollover为true
-    // 定时器不为空，到达第一个定时器的触发时间
-    while (!m_timers.empty() && rollover || !m_timers.empty() && (*m_timers.begin())->m_next <= now){
-      std::shared_ptr<Timer> temp = *m_timers.begin();
-      m_timers.erase(m_timers.begin());
+  void TimerManager::takeExpired(Timer *timer, std::vector<Callback> &cbs, std::vector<std::shared_ptr<Fiber>> &fibers,
+                                 std::vector<Callback> &inline_cbs) {
+    if(timer->m_fiber){
+      fibers.push_back(std::move(timer->m_fiber));
+      return;
+    }
+    std::vector<Callback> &out = timer->m_inline ? inline_cbs : cbs;
+    if(timer->m_recurring){
+      out.push_back(timer->m_cb.clone());
+    }else{
+      out.push_back(std::move(timer->m_cb));
+      timer->m_cb = nullptr;
+    }
+  }
 
-      cbs.push_back(temp->m_cb);
+  // 取出所有超时定时器
+  void TimerManager::listExpired(std::vector<Callback> &cbs, std::vector<std::shared_ptr<Fiber>> &fibers,
+                                 std::vector<Callback> &inline_cbs) {
+    Clock::time_point now = loopNow();
+    std::vector<std::shared_ptr<Timer>> due;
 
-      if(temp->m_recurring){
+    if(ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire)){
+      int index = currentTimerQueue();
+      if(index < 0){
+        return;
+      }
+      ThreadQueue &queue = queues[index];
+      drainInbox(queue);
+      collectDue(queue, now, due);
+      queue.size.store(queue.size.load(std::memory_order_relaxed) - due.size(), std::memory_order_relaxed);
+      for(auto &timer : due){
+        timer->m_linked = false;
+        // 触发和其它线程的取消、修改竞争，只有一方成功：
+        // 取消了的不再触发，修改了超时时间的按新的时间重新加入
+        uint8_t state = Timer::ARMED;
+        if(!timer->m_state.compare_exchange_strong(state, timer->m_recurring ? Timer::ARMED : Timer::DONE)){
+          if(state == Timer::PENDING){
+            applyPosted(queue, timer);
+          }else{
+            timer->m_cb = nullptr;
+            timer->m_fiber = nullptr;
+          }
+          continue;
+        }
+        takeExpired(timer.get(), cbs, fibers, inline_cbs);
+        if(timer->m_recurring){
+          timer->m_next = now + timer->m_period;
+          link(queue, timer);
+        }
+      }
+      return;
+    }
+
+    std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+    collectDue(m_shared, now, due);
+    for(auto &timer : due){
+      takeExpired(timer.get(), cbs, fibers, inline_cbs);
+      if(timer->m_recurring){
         // 重新加入
-        temp->m_next = now + std::chrono::milliseconds(temp->m_ms);
-        m_timers.insert(temp);
-      }else{
-        temp->m_cb = nullptr;
+        timer->m_next = now + timer->m_period;
+        insertInto(m_shared, timer);
       }
     }
   }
 
   bool TimerManager::hasTimer() {
+    if(ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire)){
+      for(size_t i = 0; i < m_threadQueueCount; ++i){
+        if(queues[i].size.load(std::memory_order_relaxed) || queues[i].inbox.load()){
+          return true;
+        }
+      }
+    }
+    if(m_nodeCount.load(std::memory_order_relaxed)){
+      return true;
+    }
     std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    return !m_timers.empty();
+    return m_shared.wheel ? !m_shared.wheel->empty() : !m_shared.timers.empty();
+  }
+
+  bool TimerManager::hasPostedTimers() {
+    ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire);
+    int index = queues ? currentTimerQueue() : -1;
+    return index >= 0 && queues[index].inbox.load();
   }
 
   // lock + tickle()
   void TimerManager::addTimer(std::shared_ptr<Timer> timer) {
+    if(ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire)){
+      int index = currentTimerQueue();
+      if(index >= 0){
+        // 当前线程正在执行协程，回到事件循环时会重新计算等待时间
+        timer->m_queue = index;
+        link(queues[index], timer);
+        return;
+      }
+      size_t n = m_threadQueueCount - m_firstPostQueue;
+      timer->m_queue = (int)(m_firstPostQueue + m_nextQueue.fetch_add(1, std::memory_order_relaxed) % n);
+      post(timer.get(), timer->latest().time_since_epoch().count());
+      return;
+    }
+
     bool at_front = false;
     {
       std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-      auto it = m_timers.insert(timer).first;
-      at_front = (it == m_timers.begin()) && !m_tickled;
+      insertInto(m_shared, timer);
 
-      // 只有一个线程在插入第一个定时器时执行“tickle”操作
+      // 事件循环醒来时这个定时器已经到了容差之内，就不需要提前唤醒
+      // 只有一个线程在插入更早的定时器时执行“tickle”操作
+      at_front = !m_tickled && timer->latest().time_since_epoch().count() < m_armed.load();
       if(at_front){
         m_tickled = true;
       }
@@ -179,18 +380,436 @@ namespace colib
     }
   }
 
-  // 检测系统时间是否发生了回滚
-  bool TimerManager::detectClockRollover() {
-    bool rollover = false;
-    auto now = std::chrono::system_clock::now();
-    // 如果当前时间 now 小于这个时间窗口的上限，
-    // 说明当前时间比上次记录的时间少了超过一小时，
-    // 这通常是由于系统时间回绕或时钟调整导致的。
-    if (now < (m_previouseTime - std::chrono::milliseconds(60 * 60 * 1000))){
-      rollover = true;
+  void TimerManager::insertInto(TimerQueue &queue, const std::shared_ptr<Timer> &timer) {
+    if(queue.wheel){
+      queue.wheel->insert(timer);
+      return;
+    }
+    queue.timers.insert(timer);
+  }
+
+  bool TimerManager::removeFrom(TimerQueue &queue, Timer *timer) {
+    if(queue.wheel){
+      return queue.wheel->remove(timer) != nullptr;
+    }
+    auto it = queue.timers.find(timer->shared_from_this());
+    if(it == queue.timers.end()){
+      return false;
+    }
+    queue.timers.erase(it);
+    return true;
+  }
+
+  bool TimerManager::nextWake(const TimerQueue &queue, Clock::time_point &tp) {
+    if(queue.wheel){
+      return queue.wheel->nextWake(tp);
+    }
+    if(queue.timers.empty()){
+      return false;
+    }
+    // 没有容差时只看第一个
+    tp = Clock::time_point::max();
+    for(auto it = queue.timers.begin(); it != queue.timers.end() && (*it)->m_next < tp; ++it){
+      tp = std::min(tp, (*it)->latest());
+    }
+    return true;
+  }
+
+  // 先全部取出再处理，循环定时器重新加入时不会被再次取出
+  void TimerManager::collectDue(TimerQueue &queue, Clock::time_point now, std::vector<std::shared_ptr<Timer>> &due) {
+    if(queue.wheel){
+      queue.wheel->advance(now, due);
+      return;
+    }
+    auto it = queue.timers.begin();
+    while(it != queue.timers.end() && (*it)->m_next <= now){
+      due.push_back(*it);
+      ++it;
+    }
+    queue.timers.erase(queue.timers.begin(), it);
+  }
+
+  /* 线程队列 */
+
+  // 所属线程直接从队列中移除；其它线程只修改状态，回调由所属线程处理收件箱时释放
+  bool TimerManager::cancelQueued(Timer *timer) {
+    uint8_t state = timer->m_state.load();
+    do{
+      if(state != Timer::ARMED && state != Timer::PENDING){
+        return false;
+      }
+    }while(!timer->m_state.compare_exchange_weak(state, Timer::CANCELLED));
+    if(timer->m_queue == currentTimerQueue()){
+      unlink(m_threadQueues.load()[timer->m_queue], timer);
+      timer->m_cb = nullptr;
+      timer->m_fiber = nullptr;
+    }else{
+      // 移除不会让等待时间提前，不需要唤醒
+      post(timer, INT64_MAX);
+    }
+    return true;
+  }
+
+  bool TimerManager::rescheduleQueued(Timer *timer, int64_t period, int64_t start) {
+    // 在自己的队列中直接修改；还在收件箱中（其它线程添加、尚未处理）的也走投递
+    if(timer->m_queue == currentTimerQueue() && timer->m_linked){
+      uint8_t state = timer->m_state.load();
+      if(state != Timer::ARMED && state != Timer::PENDING){
+        return false;
+      }
+      ThreadQueue &queue = m_threadQueues.load()[timer->m_queue];
+      std::shared_ptr<Timer> hold = timer->shared_from_this();
+      unlink(queue, timer);
+      // 之前其它线程留下的修改先生效；期间被其它线程取消的不再加入
+      if(state == Timer::PENDING){
+        if(!timer->m_state.compare_exchange_strong(state, Timer::ARMED)){
+          return false;
+        }
+        applyPending(timer);
+      }
+      std::chrono::nanoseconds old_period = timer->m_period;
+      if(period >= 0){
+        timer->m_period = std::chrono::nanoseconds(period);
+      }
+      timer->m_next = (start == Timer::KEEP_START ? timer->m_next - old_period
+                                                  : Clock::time_point(Clock::duration(start))) + timer->m_period;
+      link(queue, hold);
+      return true;
+    }
+
+    // 先留下修改再标记：所属线程看到PENDING时一定能读到修改；
+    // 标记失败说明已经触发或者取消，留下的修改会被忽略
+    if(period >= 0){
+      timer->m_pendingPeriod.store(period);
+    }
+    timer->m_pendingStart.store(start);
+    uint8_t state = timer->m_state.load();
+    do{
+      if(state != Timer::ARMED && state != Timer::PENDING){
+        return false;
+      }
+    }while(!timer->m_state.compare_exchange_weak(state, Timer::PENDING));
+    // refresh只会推迟；reset可能提前，新的超时时间要由所属线程算出，保守地按最早处理
+    post(timer, period < 0 ? INT64_MAX : INT64_MIN);
+    return true;
+  }
+
+  void TimerManager::post(Timer *timer, int64_t deadline) {
+    ThreadQueue &queue = m_threadQueues.load()[timer->m_queue];
+    // 已经在收件箱中时所属线程处理时会看到最新的状态
+    if(!timer->m_posted.exchange(true)){
+      timer->m_postHold = timer->shared_from_this();
+      Timer *head = queue.inbox.load(std::memory_order_relaxed);
+      do{
+        timer->m_postNext = head;
+      }while(!queue.inbox.compare_exchange_weak(head, timer));
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(deadline < queue.armed.load()){
+      onTimerPosted(timer->m_queue);
+    }
+  }
+
+  void TimerManager::link(ThreadQueue &queue, const std::shared_ptr<Timer> &timer) {
+    insertInto(queue, timer);
+    timer->m_linked = true;
+    queue.size.store(queue.size.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void TimerManager::unlink(ThreadQueue &queue, Timer *timer) {
+    if(!timer->m_linked){
+      return;
+    }
+    removeFrom(queue, timer);
+    timer->m_linked = false;
+    queue.size.store(queue.size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+  }
+
+  void TimerManager::drainInbox(ThreadQueue &queue) {
+    if(!queue.inbox.load(std::memory_order_relaxed)){
+      return;
+    }
+    Timer *t = queue.inbox.exchange(nullptr);
+    while(t){
+      Timer *next = t->m_postNext;
+      std::shared_ptr<Timer> hold = std::move(t->m_postHold);
+      // 先清除标记再读取状态，之后的修改会再次投递
+      t->m_posted.store(false);
+      applyPosted(queue, hold);
+      t = next;
+    }
+  }
+
+  // 按定时器当前的状态调整它在队列中的位置
+  void TimerManager::applyPosted(ThreadQueue &queue, const std::shared_ptr<Timer> &timer) {
+    uint8_t state = timer->m_state.load();
+    if(state == Timer::PENDING && !timer->m_state.compare_exchange_strong(state, Timer::ARMED)){
+      // 刚刚被取消
+      state = timer->m_state.load();
+    }
+    if(state == Timer::CANCELLED || state == Timer::DONE){
+      unlink(queue, timer.get());
+      timer->m_cb = nullptr;
+      timer->m_fiber = nullptr;
+      return;
+    }
+    // 状态先回到ARMED再读取修改，之后的修改会再次标记PENDING并投递
+    if(timer->m_linked && state != Timer::PENDING){
+      return;
+    }
+    unlink(queue, timer.get());
+    if(state == Timer::PENDING){
+      applyPending(timer.get());
+    }
+    link(queue, timer);
+  }
+
+  bool TimerManager::applyPending(Timer *timer) {
+    int64_t period = timer->m_pendingPeriod.exchange(-1);
+    int64_t start = timer->m_pendingStart.exchange(Timer::NO_START);
+    if(period < 0 && start == Timer::NO_START){
+      return false;
+    }
+    std::chrono::nanoseconds old_period = timer->m_period;
+    if(period >= 0){
+      timer->m_period = std::chrono::nanoseconds(period);
+    }
+    if(start == Timer::KEEP_START){
+      timer->m_next = timer->m_next - old_period + timer->m_period;
+    }else if(start != Timer::NO_START){
+      timer->m_next = Clock::time_point(Clock::duration(start)) + timer->m_period;
+    }
+    return true;
+  }
+
+  /* 侵入式定时器 */
+
+  TimerNode::~TimerNode() {
+    if(m_manager){
+      m_manager->cancelNode(*this);
+    }
+  }
+
+  bool TimerNode::cancel() {
+    return m_manager && m_manager->cancelNode(*this);
+  }
+
+  TimerHandle TimerManager::arm(TimerNode &node, std::chrono::nanoseconds timeout) {
+    assert(!Fiber::OnSharedStack(&node));
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    assert(!node.m_manager || node.m_manager == this);
+    node.m_manager = this;
+    node.m_next = now() + timeout;
+    node.m_slack = getTimerSlack();
+    node.m_pass = m_nodePass;
+    if(node.m_slot == ~0u){
+      // 取一个空闲的槽，没有时扩大槽表
+      if(m_freeSlot == ~0u){
+        m_freeSlot = (uint32_t)m_nodeSlots.size();
+        m_nodeSlots.emplace_back();
+      }
+      node.m_slot = m_freeSlot;
+      m_freeSlot = m_nodeSlots[node.m_slot].nextFree;
+      m_nodeSlots[node.m_slot].node = &node;
+      node.m_heapIndex = (uint32_t)m_nodeHeap.size();
+      m_nodeHeap.push_back(&node);
+      m_nodeCount.store(m_nodeHeap.size());
+      nodeUp(node.m_heapIndex);
+    }else{
+      nodeUp(node.m_heapIndex);
+      nodeDown(node.m_heapIndex);
+    }
+    nodeScheduled(&node);
+    return TimerHandle{node.m_slot, m_nodeSlots[node.m_slot].generation};
+  }
+
+  bool TimerManager::cancel(TimerHandle handle) {
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    TimerNode *node = nodeOf(handle);
+    if(!node){
+      return false;
+    }
+    releaseNode(node);
+    return true;
+  }
+
+  bool TimerManager::refresh(TimerHandle handle, std::chrono::nanoseconds timeout) {
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    TimerNode *node = nodeOf(handle);
+    if(!node){
+      return false;
+    }
+    arm(*node, timeout);
+    return true;
+  }
+
+  void TimerManager::reserveTimerNodes(size_t n) {
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    m_nodeHeap.reserve(n);
+    m_nodeSlots.reserve(n);
+  }
+
+  void TimerManager::runExpiredNodes() {
+    if(!m_nodeCount.load()){
+      return;
+    }
+    if(m_threadQueues.load(std::memory_order_acquire) && currentTimerQueue() != (int)m_firstPostQueue){
+      return;
+    }
+    Clock::time_point now = loopNow();
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    uint64_t pass = ++m_nodePass;
+    while(!m_nodeHeap.empty()){
+      TimerNode *node = m_nodeHeap[0];
+      // 回调中重新arm的节点留到下一轮，超时时间为0时不会在这里循环
+      if(node->m_next > now || node->m_pass == pass){
+        break;
+      }
+      releaseNode(node);
+      // 回调可能销毁节点，之后不能再访问node
+      if(node->m_cb){
+        node->m_cb();
+      }
+    }
+  }
+
+  TimerNode *TimerManager::nodeOf(TimerHandle handle) {
+    if(handle.index >= m_nodeSlots.size()){
+      return nullptr;
+    }
+    NodeSlot &slot = m_nodeSlots[handle.index];
+    return slot.generation == handle.generation ? slot.node : nullptr;
+  }
+
+  void TimerManager::nodeUp(size_t i) {
+    TimerNode *node = m_nodeHeap[i];
+    while(i > 0){
+      size_t parent = (i - 1) / 2;
+      if(!(node->m_next < m_nodeHeap[parent]->m_next)){
+        break;
+      }
+      m_nodeHeap[i] = m_nodeHeap[parent];
+      m_nodeHeap[i]->m_heapIndex = (uint32_t)i;
+      i = parent;
+    }
+    m_nodeHeap[i] = node;
+    node->m_heapIndex = (uint32_t)i;
+  }
+
+  void TimerManager::nodeDown(size_t i) {
+    TimerNode *node = m_nodeHeap[i];
+    size_t n = m_nodeHeap.size();
+    while(true){
+      size_t child = 2 * i + 1;
+      if(child >= n){
+        break;
+      }
+      if(child + 1 < n && m_nodeHeap[child + 1]->m_next < m_nodeHeap[child]->m_next){
+        ++child;
+      }
+      if(!(m_nodeHeap[child]->m_next < node->m_next)){
+        break;
+      }
+      m_nodeHeap[i] = m_nodeHeap[child];
+      m_nodeHeap[i]->m_heapIndex = (uint32_t)i;
+      i = child;
+    }
+    m_nodeHeap[i] = node;
+    node->m_heapIndex = (uint32_t)i;
+  }
+
+  void TimerManager::releaseNode(TimerNode *node) {
+    // 用最后一个节点填补空位
+    size_t i = node->m_heapIndex;
+    TimerNode *last = m_nodeHeap.back();
+    m_nodeHeap.pop_back();
+    if(last != node){
+      m_nodeHeap[i] = last;
+      last->m_heapIndex = (uint32_t)i;
+      nodeUp(i);
+      nodeDown(last->m_heapIndex);
+    }
+    m_nodeCount.store(m_nodeHeap.size());
+
+    NodeSlot &slot = m_nodeSlots[node->m_slot];
+    slot.node = nullptr;
+    ++slot.generation;
+    slot.nextFree = m_freeSlot;
+    m_freeSlot = node->m_slot;
+    node->m_slot = ~0u;
+    node->m_heapIndex = ~0u;
+  }
+
+  // 和nextWake一样：超时时间早于醒来时间的节点都会一起触发，醒来时间取它们最晚时间中最早的
+  // 堆中子节点不早于父节点，父节点不早于醒来时间时整棵子树都不用看
+  bool TimerManager::nodeWake(Clock::time_point &tp) {
+    if(m_nodeHeap.empty()){
+      return false;
+    }
+    tp = Clock::time_point::max();
+    size_t stack[64];
+    size_t top = 0;
+    stack[top++] = 0;
+    while(top){
+      size_t i = stack[--top];
+      TimerNode *node = m_nodeHeap[i];
+      if(!(node->m_next < tp)){
+        continue;
+      }
+      tp = std::min(tp, node->m_next + node->m_slack);
+      for(size_t child = 2 * i + 1; child <= 2 * i + 2 && child < m_nodeHeap.size(); ++child){
+        if(top < 64){
+          stack[top++] = child;
+        }
+      }
+    }
+    return true;
+  }
+
+  void TimerManager::nodeScheduled(TimerNode *node) {
+    int64_t latest = (node->m_next + node->m_slack).time_since_epoch().count();
+    if(ThreadQueue *queues = m_threadQueues.load(std::memory_order_acquire)){
+      // 执行节点的线程自己arm时，回到事件循环会重新计算等待时间
+      if(currentTimerQueue() != (int)m_firstPostQueue && latest < queues[m_firstPostQueue].armed.load()){
+        onTimerPosted((int)m_firstPostQueue);
+      }
+      return;
+    }
+    if(latest < m_armed.load()){
+      onTimerInsertedAtFront();
+    }
+  }
+
+  bool TimerManager::cancelNode(TimerNode &node) {
+    // 回调正在其它线程上执行时等它结束
+    std::lock_guard<std::recursive_mutex> lock(m_nodeMutex);
+    if(node.m_slot == ~0u){
+      return false;
+    }
+    releaseNode(&node);
+    return true;
+  }
+
+  TimerManager::Clock::time_point TimerManager::now() const {
+    if(m_clockSource == MONOTONIC_COARSE){
+      // 和CLOCK_MONOTONIC同一个起点，只是按时钟中断更新，读取不需要访问硬件计数器
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+      return Clock::time_point(std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+    }
+    return Clock::now();
+  }
+
+  TimerManager::Clock::time_point TimerManager::loopNow() const {
+    int64_t cached = m_loopNow.load(std::memory_order_relaxed);
+    return cached < 0 ? now() : Clock::time_point(Clock::duration(cached));
+  }
+
+  // 多个线程同时更新时只向前推进
+  void TimerManager::updateNow() {
+    int64_t t = now().time_since_epoch().count();
+    int64_t cached = m_loopNow.load(std::memory_order_relaxed);
+    while(cached < t && !m_loopNow.compare_exchange_weak(cached, t, std::memory_order_relaxed)){
     }
-    // 调整准确时间
-    m_previouseTime = now;
-    return rollover;
   }
 }
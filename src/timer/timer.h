@@ -1,6 +1,8 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <set>
@@ -8,39 +10,129 @@
 #include <assert.h>
 #include <functional>
 #include <mutex>
+#include "../util/callback.h"
+#include "timing_wheel.h"
 
 namespace colib
 {
   class TimerManager;
+  class Fiber;
+
+  // 侵入式定时器的句柄，每次arm得到一个；这一次到期、取消或者节点销毁之后失效，
+  // 之后用它取消、刷新都安全地返回false，不会访问节点
+  struct TimerHandle
+  {
+    uint32_t index = ~0u;    // 管理器槽表中的位置
+    uint32_t generation = 0; // 槽每次释放加一
+
+    explicit operator bool() const { return index != ~0u; }
+  };
+
+  /*
+   * 侵入式定时器：嵌入在调用者自己的对象（如每个连接的对象）或者独立栈协程的栈中，由TimerManager::arm加入
+   * 不能放在共享栈协程的栈上：管理器的堆保存节点的地址并在调整堆时写入节点，而共享栈在协程换出后会被其它协程覆盖
+   * 回调保存在节点里，不经过shared_ptr，也不放入std::set的节点，arm、cancel、refresh都不分配内存
+   * （槽表和堆的容量在达到同时arm的峰值之后不再增长，可以用reserveTimerNodes预留）
+   * 回调在事件循环线程上直接执行，要求和inline定时器一样：很短，不能阻塞、不能yield；
+   * 执行期间持有管理器的节点锁，其它线程取消或者销毁节点会等到回调结束，回调中可以重新arm或者销毁节点本身
+   * 节点析构时自动取消，必须在管理器之前销毁
+   */
+  class TimerNode
+  {
+    friend class TimerManager;
+
+  public:
+    TimerNode() = default;
+    explicit TimerNode(Callback cb) : m_cb(std::move(cb)) {}
+    ~TimerNode();
+
+    TimerNode(const TimerNode &) = delete;
+    TimerNode &operator=(const TimerNode &) = delete;
+
+    // 只能在没有arm时设置
+    void setCallback(Callback cb) { m_cb = std::move(cb); }
+    // 取消当前这一次，没有arm返回false
+    bool cancel();
+
+  private:
+    Callback m_cb;
+    TimerManager *m_manager = nullptr;
+    std::chrono::steady_clock::time_point m_next; // 超时时间
+    std::chrono::nanoseconds m_slack{0};           // arm时取管理器的默认容差
+    uint32_t m_heapIndex = ~0u;                    // 在堆中的下标
+    uint32_t m_slot = ~0u;                         // 槽表中的位置，~0u表示没有arm
+    uint64_t m_pass = 0;                           // arm时的触发轮次，同一轮中重新arm的不再触发
+  };
 
   class Timer : public std::enable_shared_from_this<Timer>
   {
     friend class TimerManager;
+    friend class TimingWheel;
+    friend class TimingWheelTest; // tests/test_timing_wheel.cc
 
   public:
     bool cancel();                          // 定时器取消
     bool refresh();                         // 定时器刷新
     bool reset(uint64_t ms, bool from_now); // 重置定时器时间
+    bool reset(std::chrono::nanoseconds period, bool from_now);
+    // 容差：定时器可以在超时时间之后slack之内的任意时刻触发，事件循环把这段时间内的多个定时器合并成一次唤醒
+    // 创建时取TimerManager::setTimerSlack设置的默认值；已经算好的等待时间不会因为减小容差而提前
+    void setSlack(std::chrono::nanoseconds slack) { m_slack.store(slack.count(), std::memory_order_relaxed); }
+    std::chrono::nanoseconds getSlack() const { return std::chrono::nanoseconds(m_slack.load(std::memory_order_relaxed)); }
 
   private:
     // 构造函数
     /*
-     * ms 定时器执行间隔时间，cb 回调函数
+     * period 定时器执行间隔时间，cb 回调函数
      * recurring 是否循环，manager 定时器管理器
      */
-    Timer(uint64_t ms, std::function<void()> cb,
+    Timer(std::chrono::nanoseconds period, Callback cb,
           bool recurring, TimerManager *manager);
 
   private:
-    bool m_recurring = false; // 是否循环
-    uint64_t m_ms = 0;        // 执行周期
+    bool m_recurring = false;          // 是否循环
+    std::chrono::nanoseconds m_period; // 执行周期
 
-    std::chrono::time_point<std::chrono::system_clock> m_next; // 绝对超时时间
-    std::function<void()> m_cb;                                // 回调函数
+    std::chrono::steady_clock::time_point m_next; // 绝对超时时间，单调时钟
+    Callback m_cb;                                             // 回调函数
+    std::shared_ptr<Fiber> m_fiber; // 协程定时器到期时唤醒的协程，和m_cb只有一个非空
+    bool m_inline = false;          // 回调在事件循环线程上直接执行
+    std::atomic<int64_t> m_slack = {0}; // 容差，纳秒
 
     TimerManager *m_manager = nullptr; // 定时器管理器
 
+    // 时间轮中的位置，m_wheelSlot为-1表示不在时间轮中
+    Timer *m_wheelPrev = nullptr;
+    Timer *m_wheelNext = nullptr;
+    int m_wheelSlot = -1;
+    uint64_t m_wheelTick = 0;
+    std::shared_ptr<Timer> m_wheelHold; // 在时间轮中时由时间轮持有
+
+    // 线程队列模式：定时器属于创建它的工作线程，只有这个线程修改它所在的队列
+    // 其它线程只修改下面的原子变量，再把定时器放入所属线程的收件箱
+    enum State : uint8_t
+    {
+      ARMED,     // 等待触发
+      PENDING,   // 其它线程修改了超时时间，所属线程处理之前不会触发
+      CANCELLED, // 已取消
+      DONE       // 一次性定时器已经触发
+    };
+    static const int64_t NO_START = -1;   // m_pendingStart：没有修改
+    static const int64_t KEEP_START = -2; // m_pendingStart：沿用原来的起点，只修改周期
+
+    int m_queue = -1;                             // 所属的线程队列，-1表示在共享队列中
+    std::atomic<uint8_t> m_state = {ARMED};
+    bool m_linked = false;                        // 在所属线程的队列中，只由所属线程访问
+    std::atomic<int64_t> m_pendingPeriod = {-1};  // 其它线程reset的新周期（纳秒），-1表示没有
+    std::atomic<int64_t> m_pendingStart = {NO_START}; // 其它线程refresh/reset的新起点（steady_clock计数）
+    std::atomic<bool> m_posted = {false};         // 在收件箱中
+    Timer *m_postNext = nullptr;
+    std::shared_ptr<Timer> m_postHold;            // 在收件箱中时由收件箱持有
+
   private:
+    // 最晚的触发时间
+    std::chrono::steady_clock::time_point latest() const { return m_next + getSlack(); }
+
     // 最小堆的比较函数
     struct Comparator
     {
@@ -54,45 +146,202 @@ namespace colib
     friend class Timer;
 
   public:
-    TimerManager();
+    // 定时器的组织方式
+    enum Queue
+    {
+      HEAP,  // 按超时时间排序的std::set，插入、取消O(log n)
+      WHEEL  // 分层时间轮，插入、取消O(1)，精度1毫秒，适合大量很少真正触发的超时
+    };
+
+    // 定时器使用单调时钟，修改系统时间不会让定时器提前或者推迟
+    enum ClockSource
+    {
+      MONOTONIC,       // CLOCK_MONOTONIC，纳秒精度
+      MONOTONIC_COARSE // CLOCK_MONOTONIC_COARSE，读取更快，精度是一个时钟中断（1~4毫秒）
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    TimerManager(Queue queue = HEAP);
     virtual ~TimerManager();
 
-    // 添加定时器
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // 在添加定时器之前设置
+    void setClockSource(ClockSource source) { m_clockSource = source; }
+    ClockSource getClockSource() const { return m_clockSource; }
+    // 按选择的时钟源读取当前时间
+    Clock::time_point now() const;
+
+    // 新建定时器的默认容差（Timer::setSlack），默认0
+    // 超时时间相差不到容差的定时器在同一次唤醒中触发；插入的定时器最晚时间不早于事件循环等待到的时间时不唤醒它
+    void setTimerSlack(std::chrono::nanoseconds slack) { m_slack.store(slack.count(), std::memory_order_relaxed); }
+    std::chrono::nanoseconds getTimerSlack() const { return std::chrono::nanoseconds(m_slack.load(std::memory_order_relaxed)); }
+
+    // 添加定时器，ms为毫秒；亚毫秒的间隔使用std::chrono的重载，如std::chrono::microseconds(200)
+    std::shared_ptr<Timer> addTimer(uint64_t ms, Callback cb, bool recurring = false);
+    std::shared_ptr<Timer> addTimer(std::chrono::nanoseconds period, Callback cb, bool recurring = false);
 
     // 添加条件定时器
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb,
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, Callback cb,
+                                             std::weak_ptr<void> weak_cond, bool recurring = false);
+    std::shared_ptr<Timer> addConditionTimer(std::chrono::nanoseconds period, Callback cb,
                                              std::weak_ptr<void> weak_cond, bool recurring = false);
 
-    // 找到最近的超时时间
+    // 协程定时器：到期时直接把fiber放回任务队列，不需要回调，也不需要一个协程来执行回调；只触发一次
+    std::shared_ptr<Timer> addFiberTimer(std::chrono::nanoseconds timeout, std::shared_ptr<Fiber> fiber);
+
+    // inline定时器：回调在事件循环线程上取出后直接执行，不经过调度器
+    // 回调必须很短，不能阻塞、不能yield，也不能调用会让出协程的hook函数
+    std::shared_ptr<Timer> addInlineTimer(std::chrono::nanoseconds period, Callback cb, bool recurring = false);
+
+    // 找到最近需要醒来的时间（合并了容差内的定时器），单位毫秒，不足一毫秒向上取整，没有定时器返回~0ull
     uint64_t getNextTimer();
+    // 同上，单位纳秒
+    uint64_t getNextTimerNs();
 
     // 取出所有超时定时器的回调函数
-    void listExpiredCb(std::vector<std::function<void()>> &cbs);
+    // 一次性定时器的回调直接移出，循环定时器的回调拷贝一份
+    // inline定时器的回调也放入cbs，协程定时器转换成调度该协程的回调
+    void listExpiredCb(std::vector<Callback> &cbs);
+    // 按执行方式分开取出：普通回调放入cbs，协程定时器的协程放入fibers，inline回调放入inline_cbs
+    void listExpired(std::vector<Callback> &cbs, std::vector<std::shared_ptr<Fiber>> &fibers,
+                     std::vector<Callback> &inline_cbs);
 
     // 堆中是否有定时器
     bool hasTimer();
 
+    // 侵入式定时器（TimerNode）
+    // timeout之后执行node的回调，返回这一次的句柄；node已经arm时只修改超时时间，句柄不变
+    TimerHandle arm(TimerNode &node, std::chrono::nanoseconds timeout);
+    // 句柄对应的这一次已经到期、取消或者节点已经销毁时返回false
+    bool cancel(TimerHandle handle);
+    // 超时时间改为从现在起timeout之后
+    bool refresh(TimerHandle handle, std::chrono::nanoseconds timeout);
+    // 预留容量，同时arm的节点不超过n个时arm不分配内存
+    void reserveTimerNodes(size_t n);
+    // 执行到期节点的回调，在调用线程上直接执行；线程队列模式下只有第一个接收投递的工作线程执行
+    void runExpiredNodes();
+
   protected:
+    // 线程队列模式：每个工作线程一个私有的定时器队列，需要在添加定时器之前设置
+    // 工作线程添加的定时器放入自己的队列，不加锁，也不需要唤醒（回到事件循环时会重新计算等待时间）；
+    // 其它线程添加的定时器轮流分给各个队列，通过无锁的收件箱交给所属线程
+    // 所属线程取消、刷新定时器不加锁，其它线程只设置状态并投递到收件箱
+    // getNextTimer和listExpired只处理当前线程的队列
+    // 非工作线程添加的定时器只分给下标从first开始的队列
+    void setThreadQueues(size_t count, size_t first = 0);
+    // 当前线程的队列下标，-1表示不是工作线程
+    virtual int currentTimerQueue() { return -1; }
+    // 其它线程投递的定时器早于队列所属线程等待到的时间，需要唤醒它
+    virtual void onTimerPosted(int /*queue*/) {}
+    // 当前线程的收件箱中是否有没有处理的定时器，登记等待之后检查，和投递者检查等待时间配对
+    bool hasPostedTimers();
+
+    // 事件循环每轮调用，之后getNextTimer和listExpiredCb使用缓存的时间，不再各自读取时钟
+    // 添加、刷新定时器仍然读取时钟：协程可能在两轮之间运行了很久，用缓存的时间会让定时器提前触发
+    void updateNow();
+    // 缓存的当前时间，没有缓存时读取时钟
+    Clock::time_point loopNow() const;
     // 当一个最早的定时器加入堆中时调用
     virtual void onTimerInsertedAtFront() {};
     // 添加定时器
     void addTimer(std::shared_ptr<Timer> timer);
 
   private:
-    // 系统时间改变时调用该函数
-    bool detectClockRollover();
+    friend class TimerNode;
+
+    // 槽表的一项，空闲的槽串成链表
+    struct NodeSlot
+    {
+      TimerNode *node = nullptr;
+      uint32_t generation = 0;
+      uint32_t nextFree = ~0u;
+    };
+
+    // 一组定时器，wheel为空时使用timers
+    struct TimerQueue
+    {
+      std::set<std::shared_ptr<Timer>, Timer::Comparator> timers; // 时间堆
+      std::unique_ptr<TimingWheel> wheel;                         // 时间轮
+    };
+
+    // 工作线程私有的队列
+    struct alignas(64) ThreadQueue : TimerQueue
+    {
+      std::atomic<Timer *> inbox = {nullptr};    // 其它线程投递的定时器，无锁栈
+      std::atomic<int64_t> armed = {INT64_MAX}; // 所属线程等待到的时间（steady_clock计数）
+      std::atomic<size_t> size = {0};           // 队列中的定时器数，只由所属线程写
+    };
+
+    // 创建还没有加入队列的定时器
+    std::shared_ptr<Timer> newTimer(std::chrono::nanoseconds period, Callback cb, bool recurring);
+
+    // 以下操作一个队列，共享队列在持有写锁时调用，线程队列由所属线程调用
+    static void insertInto(TimerQueue &queue, const std::shared_ptr<Timer> &timer);
+    // 移除，不在队列中返回false
+    static bool removeFrom(TimerQueue &queue, Timer *timer);
+    // 需要醒来的时间：从最早的定时器开始，超时时间早于醒来时间的定时器都会一起触发，
+    // 醒来时间取它们最晚时间中最早的；队列为空时返回false
+    static bool nextWake(const TimerQueue &queue, Clock::time_point &tp);
+    // 取出所有到期的定时器
+    static void collectDue(TimerQueue &queue, Clock::time_point now, std::vector<std::shared_ptr<Timer>> &due);
+    // 取出到期定时器要执行的内容
+    static void takeExpired(Timer *timer, std::vector<Callback> &cbs, std::vector<std::shared_ptr<Fiber>> &fibers,
+                            std::vector<Callback> &inline_cbs);
+
+    // 线程队列模式
+    bool cancelQueued(Timer *timer);
+    // period为-1时不修改周期，start为新超时时间的起点或者Timer::KEEP_START
+    bool rescheduleQueued(Timer *timer, int64_t period, int64_t start);
+    // 投递到所属线程的收件箱，deadline（最晚时间）早于所属线程的等待时间时唤醒它
+    void post(Timer *timer, int64_t deadline);
+    // 以下由所属线程调用
+    void link(ThreadQueue &queue, const std::shared_ptr<Timer> &timer);
+    void unlink(ThreadQueue &queue, Timer *timer);
+    void drainInbox(ThreadQueue &queue);
+    void applyPosted(ThreadQueue &queue, const std::shared_ptr<Timer> &timer);
+    // 应用其它线程留下的修改，返回是否修改了超时时间
+    static bool applyPending(Timer *timer);
+
+    // 侵入式定时器，以下在持有m_nodeMutex时调用
+    TimerNode *nodeOf(TimerHandle handle);
+    void nodeUp(size_t i);
+    void nodeDown(size_t i);
+    // 从堆中移除并释放槽，之后旧句柄失效
+    void releaseNode(TimerNode *node);
+    bool nodeWake(Clock::time_point &tp);
+    // 新的超时时间早于事件循环等待到的时间时唤醒它
+    void nodeScheduled(TimerNode *node);
+    bool cancelNode(TimerNode &node);
 
   private:
     std::shared_mutex m_mutex;
-    // 时间堆
-    std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;
+    // 共享队列
+    TimerQueue m_shared;
+    Queue m_queueType = HEAP;
+    // 线程队列，为空时所有线程使用共享队列
+    std::unique_ptr<ThreadQueue[]> m_threadQueueStorage;
+    std::atomic<ThreadQueue *> m_threadQueues = {nullptr};
+    size_t m_threadQueueCount = 0;
+    size_t m_firstPostQueue = 0;
+    std::atomic<size_t> m_nextQueue = {0}; // 非工作线程添加的定时器轮流分配
     // 在下次getNextTime()执行前
     // onTimerInsertedAtFront()是否已经被触发了
     // -> 在此过程中 onTimerInsertedAtFront()只执行一次
     bool m_tickled = false;
-    // 上次检查系统时间是否回退的绝对时间
-    std::chrono::time_point<std::chrono::system_clock> m_previouseTime;
+    // 共享队列：事件循环等待到的时间（steady_clock计数），最晚时间不早于它的定时器不需要唤醒
+    std::atomic<int64_t> m_armed = {INT64_MAX};
+    std::atomic<int64_t> m_slack = {0}; // 默认容差，纳秒
+
+    // 侵入式定时器：按超时时间的二叉堆，节点记录自己的下标；回调执行期间也持有锁，所以是递归锁
+    std::recursive_mutex m_nodeMutex;
+    std::vector<TimerNode *> m_nodeHeap;
+    std::vector<NodeSlot> m_nodeSlots;
+    uint32_t m_freeSlot = ~0u;
+    uint64_t m_nodePass = 0;
+    std::atomic<size_t> m_nodeCount = {0};
+    ClockSource m_clockSource = MONOTONIC;
+    // 事件循环缓存的当前时间（steady_clock的计数），-1表示没有缓存
+    std::atomic<int64_t> m_loopNow = {-1};
   };
 
 }
@@ -0,0 +1,337 @@
+#include "timing_wheel.h"
+#include "timer.h"
+
+namespace colib
+{
+  TimingWheel::TimingWheel(Clock::time_point now) : m_origin(now)
+  {
+  }
+
+  // 释放时间轮持有的引用
+  TimingWheel::~TimingWheel()
+  {
+    std::vector<std::shared_ptr<Timer>> timers;
+    drain(timers);
+  }
+
+  uint64_t TimingWheel::expireTick(const Timer *timer) const
+  {
+    if (timer->m_next <= m_origin)
+    {
+      return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(timer->m_next - m_origin).count();
+  }
+
+  uint64_t TimingWheel::nowTick(Clock::time_point now) const
+  {
+    if (now <= m_origin)
+    {
+      return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now - m_origin).count();
+  }
+
+  void TimingWheel::link(int slot, Timer *timer)
+  {
+    Timer *head = m_slots[slot];
+    timer->m_wheelPrev = nullptr;
+    timer->m_wheelNext = head;
+    if (head)
+    {
+      head->m_wheelPrev = timer;
+    }
+    m_slots[slot] = timer;
+    timer->m_wheelSlot = slot;
+    m_bitmap[slot >> 6] |= 1ull << (slot & 63);
+  }
+
+  void TimingWheel::unlink(Timer *timer)
+  {
+    int slot = timer->m_wheelSlot;
+    if (timer->m_wheelPrev)
+    {
+      timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+    }
+    else
+    {
+      m_slots[slot] = timer->m_wheelNext;
+    }
+    if (timer->m_wheelNext)
+    {
+      timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+    }
+    if (!m_slots[slot])
+    {
+      m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    }
+    timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+    timer->m_wheelSlot = -1;
+  }
+
+  Timer *TimingWheel::take(int slot)
+  {
+    Timer *head = m_slots[slot];
+    m_slots[slot] = nullptr;
+    m_bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    return head;
+  }
+
+  // 按照和当前时间的距离选择层，距离越远格子越粗
+  void TimingWheel::place(Timer *timer)
+  {
+    uint64_t expire = timer->m_wheelTick;
+    if (expire < m_current)
+    {
+      link(DUE_SLOT, timer);
+      return;
+    }
+    uint64_t delta = expire - m_current;
+    for (int level = 0; level < LEVELS; ++level)
+    {
+      uint64_t span = (uint64_t)1 << (shift(level) + (level ? LEVEL_BITS : ROOT_BITS));
+      if (delta < span || level == LEVELS - 1)
+      {
+        if (delta >= span)
+        {
+          // 超出范围的放在最后一层最远的格子，级联时再重新分配
+          expire = m_current + span - 1;
+        }
+        link(slotBase(level) + ((expire >> shift(level)) & (levelSize(level) - 1)), timer);
+        return;
+      }
+    }
+  }
+
+  void TimingWheel::insert(std::shared_ptr<Timer> timer)
+  {
+    Timer *t = timer.get();
+    t->m_wheelTick = expireTick(t);
+    t->m_wheelHold = std::move(timer);
+    place(t);
+    ++m_count;
+  }
+
+  std::shared_ptr<Timer> TimingWheel::remove(Timer *timer)
+  {
+    if (timer->m_wheelSlot < 0)
+    {
+      return nullptr;
+    }
+    unlink(timer);
+    --m_count;
+    return std::move(timer->m_wheelHold);
+  }
+
+  // 当前时间到达level层某一格的起点，把这一格的定时器分配到更低的层
+  void TimingWheel::cascade(int level)
+  {
+    uint64_t index = (m_current >> shift(level)) & (LEVEL_SIZE - 1);
+    Timer *t = take(slotBase(level) + index);
+    while (t)
+    {
+      Timer *next = t->m_wheelNext;
+      place(t);
+      t = next;
+    }
+  }
+
+  // 每层的起点和大小都是64的倍数，一个64位字不会跨层
+  int TimingWheel::findSlot(int level, uint64_t index) const
+  {
+    int base = slotBase(level);
+    uint64_t size = levelSize(level);
+    // 先找index到本层末尾，再从本层开头找到index
+    for (uint64_t i = index; i < size;)
+    {
+      int slot = base + (int)i;
+      uint64_t word = m_bitmap[slot >> 6] >> (slot & 63);
+      if (word)
+      {
+        return (int)(i + __builtin_ctzll(word) - index);
+      }
+      i += 64 - (slot & 63);
+    }
+    for (uint64_t i = 0; i < index;)
+    {
+      int slot = base + (int)i;
+      uint64_t word = m_bitmap[slot >> 6] >> (slot & 63);
+      if (word)
+      {
+        uint64_t found = i + __builtin_ctzll(word);
+        return found < index ? (int)(found + size - index) : -1;
+      }
+      i += 64 - (slot & 63);
+    }
+    return -1;
+  }
+
+  bool TimingWheel::nextExpire(Clock::time_point &tp) const
+  {
+    if (!m_count)
+    {
+      return false;
+    }
+    if (m_slots[DUE_SLOT])
+    {
+      tp = m_origin;
+      return true;
+    }
+
+    uint64_t best = cascadeTick();
+
+    // 第0层第一个非空格子中的定时器都在同一毫秒，取其中准确的时间：
+    // 当前这一毫秒如果只给格子的起点会在这一毫秒内空转，之后的格子给起点会在亚毫秒等待时提前醒来一次
+    tp = best == ~0ull ? Clock::time_point::max() : m_origin + std::chrono::milliseconds(best);
+    int offset = findSlot(0, m_current & (ROOT_SIZE - 1));
+    if (offset >= 0 && m_current + offset < best)
+    {
+      for (Timer *t = m_slots[(m_current + offset) & (ROOT_SIZE - 1)]; t; t = t->m_wheelNext)
+      {
+        tp = std::min(tp, t->m_next);
+      }
+    }
+    return true;
+  }
+
+  // 高层给出级联的时间
+  uint64_t TimingWheel::cascadeTick() const
+  {
+    uint64_t best = ~0ull;
+    for (int level = 1; level < LEVELS; ++level)
+    {
+      // 本层第一个还没有级联的格子
+      uint64_t unit = (uint64_t)1 << shift(level);
+      uint64_t first = (m_current + unit - 1) >> shift(level);
+      int offset = findSlot(level, first & (LEVEL_SIZE - 1));
+      if (offset >= 0)
+      {
+        best = std::min(best, (first + offset) << shift(level));
+      }
+    }
+    return best;
+  }
+
+  bool TimingWheel::nextWake(Clock::time_point &tp) const
+  {
+    if (!nextExpire(tp))
+    {
+      return false;
+    }
+    if (m_slots[DUE_SLOT])
+    {
+      return true;
+    }
+    // 从第0层当前格子往后，起点早于醒来时间的格子中的定时器都会在醒来时触发，
+    // 醒来时间不能晚于它们之中最早的最晚时间；级联的时间不能跳过
+    uint64_t best = cascadeTick();
+    Clock::time_point wake = best == ~0ull ? Clock::time_point::max() : m_origin + std::chrono::milliseconds(best);
+    uint64_t end = std::min(best, m_current + ROOT_SIZE);
+    uint64_t tick = m_current;
+    while (tick < end)
+    {
+      int offset = findSlot(0, tick & (ROOT_SIZE - 1));
+      if (offset < 0)
+      {
+        break;
+      }
+      tick += offset;
+      if (tick >= end || m_origin + std::chrono::milliseconds(tick) >= wake)
+      {
+        break;
+      }
+      for (Timer *t = m_slots[tick & (ROOT_SIZE - 1)]; t; t = t->m_wheelNext)
+      {
+        wake = std::min(wake, t->latest());
+      }
+      ++tick;
+    }
+    tp = wake;
+    return true;
+  }
+
+  void TimingWheel::collect(Timer *t, std::vector<std::shared_ptr<Timer>> &expired)
+  {
+    while (t)
+    {
+      Timer *next = t->m_wheelNext;
+      t->m_wheelPrev = t->m_wheelNext = nullptr;
+      t->m_wheelSlot = -1;
+      --m_count;
+      expired.push_back(std::move(t->m_wheelHold));
+      t = next;
+    }
+  }
+
+  // 当前时间到达第0层一圈的起点时逐层级联，上一层这一格的起点同时也是再上一层的起点时继续
+  // 同一个起点重复级联没有影响：级联之后新插入的定时器不会落到刚刚级联过的格子
+  void TimingWheel::cascadeAll()
+  {
+    if (m_current & (ROOT_SIZE - 1))
+    {
+      return;
+    }
+    for (int level = 1; level < LEVELS; ++level)
+    {
+      cascade(level);
+      if ((m_current >> shift(level)) & (LEVEL_SIZE - 1))
+      {
+        break;
+      }
+    }
+  }
+
+  void TimingWheel::advance(Clock::time_point now, std::vector<std::shared_ptr<Timer>> &expired)
+  {
+    uint64_t target = nowTick(now);
+    collect(take(DUE_SLOT), expired);
+
+    // 已经完整过去的毫秒，整格取出
+    while (m_current < target)
+    {
+      if (!m_count)
+      {
+        m_current = target;
+        break;
+      }
+      cascadeAll();
+      collect(take(m_current & (ROOT_SIZE - 1)), expired);
+      ++m_current;
+
+      // 跳过第0层中空的格子，但不能越过下一次级联
+      if (m_current & (ROOT_SIZE - 1))
+      {
+        uint64_t boundary = (m_current | (ROOT_SIZE - 1)) + 1;
+        int offset = findSlot(0, m_current & (ROOT_SIZE - 1));
+        uint64_t next = offset >= 0 ? m_current + offset : boundary;
+        m_current = std::min({next, boundary, target});
+      }
+    }
+
+    // 当前这一毫秒只取出已经到期的，和堆的触发时间一致
+    if (m_count)
+    {
+      cascadeAll();
+      Timer *t = m_slots[m_current & (ROOT_SIZE - 1)];
+      while (t)
+      {
+        Timer *next = t->m_wheelNext;
+        if (t->m_next <= now)
+        {
+          unlink(t);
+          --m_count;
+          expired.push_back(std::move(t->m_wheelHold));
+        }
+        t = next;
+      }
+    }
+  }
+
+  void TimingWheel::drain(std::vector<std::shared_ptr<Timer>> &expired)
+  {
+    for (int slot = 0; slot <= SLOTS; ++slot)
+    {
+      collect(take(slot), expired);
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace colib
+{
+  class Timer;
+
+  /*
+   * 分层时间轮，每格1毫秒
+   * 第0层256格，覆盖256毫秒；往上每层64格，每格是下一层一整圈，五层覆盖约50天，更远的放在最后一格
+   * 定时器挂在所在格子的侵入式双向链表上，插入和取消都是O(1)，不分配内存
+   * 时间推进到高层某一格的起点时，把这一格的定时器按剩余时间重新分配到低层（级联）
+   * 时间轮不加锁，由TimerManager的锁保护
+   */
+  class TimingWheel
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimingWheel(Clock::time_point now);
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    // 按timer->m_next放入对应的格子，时间轮持有一份引用直到取出
+    void insert(std::shared_ptr<Timer> timer);
+    // 不在时间轮中返回nullptr
+    std::shared_ptr<Timer> remove(Timer *timer);
+
+    bool empty() const { return m_count == 0; }
+    size_t size() const { return m_count; }
+
+    // 下一次需要推进的时间：第0层是准确的超时时间，高层是级联的时间，不会晚于真正的超时时间
+    // 时间轮为空时返回false
+    bool nextExpire(Clock::time_point &tp) const;
+    // 考虑定时器的容差后最晚可以醒来的时间：醒来时所有已经到期的定时器一起触发
+    bool nextWake(Clock::time_point &tp) const;
+
+    // 推进到now，取出所有到期的定时器
+    void advance(Clock::time_point now, std::vector<std::shared_ptr<Timer>> &expired);
+    // 取出所有定时器
+    void drain(std::vector<std::shared_ptr<Timer>> &expired);
+
+  private:
+    static const int LEVELS = 5;
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const uint64_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const uint64_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    // 格子编号：第0层0~255，第n层 256 + (n-1)*64 ~
+    static const int SLOTS = ROOT_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+    static const int DUE_SLOT = SLOTS; // 插入时已经到期的定时器
+
+    static int shift(int level) { return level ? ROOT_BITS + (level - 1) * LEVEL_BITS : 0; }
+    static int slotBase(int level) { return level ? ROOT_SIZE + (level - 1) * LEVEL_SIZE : 0; }
+    static uint64_t levelSize(int level) { return level ? LEVEL_SIZE : ROOT_SIZE; }
+
+    // 时间向下取整到格子，同一格中的定时器在这一毫秒内按准确的时间触发
+    uint64_t expireTick(const Timer *timer) const;
+    uint64_t nowTick(Clock::time_point now) const;
+
+    void link(int slot, Timer *timer);
+    void unlink(Timer *timer);
+    // 把一个格子的链表整个摘下来
+    Timer *take(int slot);
+    void place(Timer *timer);
+    void cascade(int level);
+    void cascadeAll();
+    // 取出链表上所有的定时器
+    void collect(Timer *t, std::vector<std::shared_ptr<Timer>> &expired);
+    // 在level层中从index开始（含）找第一个非空格子的偏移，没有返回-1
+    int findSlot(int level, uint64_t index) const;
+    // 高层中下一个需要级联的时间，没有返回~0ull
+    uint64_t cascadeTick() const;
+
+  private:
+    Clock::time_point m_origin;
+    uint64_t m_current = 0; // 当前正在处理的格子对应的时间，之前的都已经处理过
+    size_t m_count = 0;
+    Timer *m_slots[SLOTS + 1] = {};
+    uint64_t m_bitmap[(SLOTS + 1 + 63) / 64] = {}; // 非空的格子
+  };
+}
+
+#endif
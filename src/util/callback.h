@@ -0,0 +1,213 @@
+#ifndef CALLBACK_H
+#define CALLBACK_H
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace colib
+{
+  /*
+   * 只能移动的void()可调用对象，用来代替调度、定时器和IO事件里的std::function<void()>
+   * 不超过INLINE_SIZE字节且可以nothrow移动的对象直接存放在内部，不会分配内存，
+   * 几个指针加一个fd的lambda都在这个范围内；更大的对象才放到堆上。
+   * 不能拷贝，只在目标本身可拷贝时可以显式clone()
+   */
+  class Callback
+  {
+  public:
+    static const size_t INLINE_SIZE = 56;
+
+    Callback() noexcept = default;
+    Callback(std::nullptr_t) noexcept {}
+
+    template <class F,
+              class D = std::decay_t<F>,
+              class = std::enable_if_t<!std::is_same_v<D, Callback> && std::is_invocable_v<D &>>>
+    Callback(F &&f)
+    {
+      if (IsNull(f))
+      {
+        return;
+      }
+      if constexpr (IsInline<D>())
+      {
+        ::new ((void *)m_storage) D(std::forward<F>(f));
+        m_ops = &InlineOps<D>::ops;
+      }
+      else
+      {
+        *(D **)m_storage = new D(std::forward<F>(f));
+        m_ops = &HeapOps<D>::ops;
+      }
+    }
+
+    Callback(Callback &&other) noexcept
+    {
+      moveFrom(other);
+    }
+
+    Callback &operator=(Callback &&other) noexcept
+    {
+      if (this != &other)
+      {
+        reset();
+        moveFrom(other);
+      }
+      return *this;
+    }
+
+    Callback &operator=(std::nullptr_t) noexcept
+    {
+      reset();
+      return *this;
+    }
+
+    Callback(const Callback &) = delete;
+    Callback &operator=(const Callback &) = delete;
+
+    ~Callback() { reset(); }
+
+    void operator()()
+    {
+      assert(m_ops);
+      m_ops->invoke(m_storage);
+    }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+    friend bool operator==(const Callback &cb, std::nullptr_t) noexcept { return !cb.m_ops; }
+
+    void swap(Callback &other) noexcept
+    {
+      Callback tmp(std::move(other));
+      other = std::move(*this);
+      *this = std::move(tmp);
+    }
+
+    // 目标是否可以拷贝
+    bool copyable() const noexcept { return !m_ops || m_ops->clone; }
+
+    // 拷贝一份，目标必须可以拷贝
+    Callback clone() const
+    {
+      Callback cb;
+      if (m_ops)
+      {
+        assert(m_ops->clone);
+        m_ops->clone(cb.m_storage, m_storage);
+        cb.m_ops = m_ops;
+      }
+      return cb;
+    }
+
+    // 目标是否存放在内部
+    bool isInline() const noexcept { return !m_ops || m_ops->inlined; }
+
+  private:
+    struct Ops
+    {
+      void (*invoke)(void *storage);
+      void (*move)(void *dst, void *src); // 移动到dst并销毁src
+      void (*destroy)(void *storage);
+      void (*clone)(void *dst, const void *src); // 目标不可拷贝时为nullptr
+      bool inlined;
+    };
+
+    template <class D>
+    static constexpr bool IsInline()
+    {
+      return sizeof(D) <= INLINE_SIZE && alignof(D) <= alignof(std::max_align_t) &&
+             std::is_nothrow_move_constructible_v<D>;
+    }
+
+    // 空的函数指针和std::function转换成空的Callback；函数引用不可能为空，不做比较
+    template <class F>
+    static bool IsNull(const F &f)
+    {
+      using D = std::decay_t<F>;
+      if constexpr (std::is_pointer_v<F> || std::is_member_pointer_v<F>)
+      {
+        return f == nullptr;
+      }
+      else if constexpr (std::is_same_v<D, std::function<void()>>)
+      {
+        return !f;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    // 只在目标可拷贝时才实例化clone
+    template <class Impl>
+    static constexpr auto CloneOf() -> void (*)(void *, const void *)
+    {
+      if constexpr (std::is_copy_constructible_v<typename Impl::Target>)
+      {
+        return &Impl::clone;
+      }
+      else
+      {
+        return nullptr;
+      }
+    }
+
+    template <class D>
+    struct InlineOps
+    {
+      using Target = D;
+      static void invoke(void *s) { (*(D *)s)(); }
+      static void move(void *dst, void *src)
+      {
+        ::new (dst) D(std::move(*(D *)src));
+        ((D *)src)->~D();
+      }
+      static void destroy(void *s) { ((D *)s)->~D(); }
+      static void clone(void *dst, const void *src) { ::new (dst) D(*(const D *)src); }
+
+      static constexpr Ops ops = {&invoke, &move, &destroy, CloneOf<InlineOps>(), true};
+    };
+
+    template <class D>
+    struct HeapOps
+    {
+      using Target = D;
+      static void invoke(void *s) { (**(D **)s)(); }
+      static void move(void *dst, void *src) { *(D **)dst = *(D **)src; }
+      static void destroy(void *s) { delete *(D **)s; }
+      static void clone(void *dst, const void *src) { *(D **)dst = new D(**(D *const *)src); }
+
+      static constexpr Ops ops = {&invoke, &move, &destroy, CloneOf<HeapOps>(), false};
+    };
+
+    void moveFrom(Callback &other) noexcept
+    {
+      if (other.m_ops)
+      {
+        other.m_ops->move(m_storage, other.m_storage);
+        m_ops = other.m_ops;
+        other.m_ops = nullptr;
+      }
+    }
+
+    void reset() noexcept
+    {
+      if (m_ops)
+      {
+        const Ops *ops = m_ops;
+        m_ops = nullptr;
+        ops->destroy(m_storage);
+      }
+    }
+
+  private:
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const Ops *m_ops = nullptr;
+  };
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace colib
+{
+  /*
+   * 以fd为下标的两级表，只增不减
+   * 第一级是固定大小的块指针数组，第二级每块CHUNK_SIZE个元素，第一次用到某个fd范围时才分配
+   * 查找是无等待的：两次数组访问，不加锁；已经分配的元素地址在表的生命周期内不变
+   * 多个线程同时分配同一块时用CAS发布，失败的一方释放自己的块
+   */
+  template <class T>
+  class FdTable
+  {
+  public:
+    static constexpr size_t CHUNK_BITS = 10;
+    static constexpr size_t CHUNK_SIZE = (size_t)1 << CHUNK_BITS; // 每块1024个fd
+    static constexpr size_t MAX_CHUNKS = 4096;                    // 最多支持4M个fd
+
+    FdTable() = default;
+    FdTable(const FdTable &) = delete;
+    FdTable &operator=(const FdTable &) = delete;
+
+    ~FdTable()
+    {
+      for (auto &chunk : m_chunks)
+      {
+        delete chunk.load(std::memory_order_relaxed);
+      }
+    }
+
+    // fd所在的块还没有分配时返回nullptr
+    T *get(int fd) const
+    {
+      if (fd < 0 || (size_t)fd >= CHUNK_SIZE * MAX_CHUNKS)
+      {
+        return nullptr;
+      }
+      Chunk *chunk = m_chunks[(size_t)fd >> CHUNK_BITS].load(std::memory_order_acquire);
+      return chunk ? &chunk->items[(size_t)fd & (CHUNK_SIZE - 1)] : nullptr;
+    }
+
+    // 块不存在时分配，新块的每个元素发布前先调用init(item, fd)；fd超出范围返回nullptr
+    template <class Init>
+    T *getOrCreate(int fd, Init init)
+    {
+      T *item = get(fd);
+      if (item || fd < 0 || (size_t)fd >= CHUNK_SIZE * MAX_CHUNKS)
+      {
+        return item;
+      }
+
+      size_t index = (size_t)fd >> CHUNK_BITS;
+      Chunk *chunk = new Chunk();
+      for (size_t i = 0; i < CHUNK_SIZE; ++i)
+      {
+        init(chunk->items[i], (int)((index << CHUNK_BITS) + i));
+      }
+      Chunk *expected = nullptr;
+      if (!m_chunks[index].compare_exchange_strong(expected, chunk, std::memory_order_acq_rel,
+                                                   std::memory_order_acquire))
+      {
+        delete chunk;
+        chunk = expected;
+      }
+      return &chunk->items[(size_t)fd & (CHUNK_SIZE - 1)];
+    }
+
+  private:
+    struct Chunk
+    {
+      T items[CHUNK_SIZE];
+    };
+
+    std::atomic<Chunk *> m_chunks[MAX_CHUNKS] = {};
+  };
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef WORK_STEALING_QUEUE_H
+#define WORK_STEALING_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace colib
+{
+  /*
+   * Chase-Lev无锁双端队列（Lê等人的C11内存序版本）
+   * 只有拥有者线程可以push，从bottom端放入；任何线程都可以steal，从top端CAS取出
+   * 拥有者自己也从top端取，保持先进先出，和原来全局任务队列的调度顺序一致
+   * 元素只能是指针这类可以原子读写的小对象
+   * 容量不够时翻倍，旧数组可能还在被窃取者读取，保留到队列析构时再释放
+   */
+  template <class T>
+  class WorkStealingQueue
+  {
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingQueue element must be trivially copyable");
+
+  public:
+    explicit WorkStealingQueue(size_t capacity = 256)
+    {
+      assert(capacity && !(capacity & (capacity - 1)));
+      m_arrays.emplace_back(new Array(capacity));
+      m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingQueue(const WorkStealingQueue &) = delete;
+    WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+    // 只能由拥有者线程调用
+    void push(T item)
+    {
+      int64_t b = m_bottom.load(std::memory_order_relaxed);
+      int64_t t = m_top.load(std::memory_order_acquire);
+      Array *a = m_array.load(std::memory_order_relaxed);
+      if (b - t > (int64_t)a->capacity - 1)
+      {
+        a = grow(a, t, b);
+      }
+      a->put(b, item);
+      std::atomic_thread_fence(std::memory_order_release);
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 任何线程都可以调用，队列为空返回false；与其它窃取者竞争失败时重试
+    bool steal(T &item)
+    {
+      while (true)
+      {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+          return false;
+        }
+
+        Array *a = m_array.load(std::memory_order_acquire);
+        T x = a->get(t);
+        if (m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+        {
+          item = x;
+          return true;
+        }
+      }
+    }
+
+    // 近似的元素个数，只用于判断和统计
+    size_t size() const
+    {
+      int64_t b = m_bottom.load(std::memory_order_relaxed);
+      int64_t t = m_top.load(std::memory_order_relaxed);
+      return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+  private:
+    struct Array
+    {
+      size_t capacity;
+      size_t mask;
+      std::unique_ptr<std::atomic<T>[]> slots;
+
+      explicit Array(size_t cap) : capacity(cap), mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+
+      T get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+      void put(int64_t i, T x) { slots[i & mask].store(x, std::memory_order_relaxed); }
+    };
+
+    Array *grow(Array *old, int64_t t, int64_t b)
+    {
+      Array *a = new Array(old->capacity * 2);
+      for (int64_t i = t; i < b; ++i)
+      {
+        a->put(i, old->get(i));
+      }
+      m_arrays.emplace_back(a);
+      m_array.store(a, std::memory_order_release);
+      return a;
+    }
+
+  private:
+    // top和bottom分别被窃取者和拥有者频繁修改，放在不同的缓存行
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    alignas(64) std::atomic<Array *> m_array{nullptr};
+    std::vector<std::unique_ptr<Array>> m_arrays; // 只由拥有者修改
+  };
+}
+
+#endif
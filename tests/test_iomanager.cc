@@ -1,5 +1,11 @@
 #include "../src/iomanager/ioscheduler.h"
+#include "../src/hook/hook.h"
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -31,8 +37,162 @@ void func2()
   send(sock, data, sizeof(data), 0);
 }
 
+/*
+ * 共享栈协程上的带超时读：一个协程recv等待SO_RCVTIMEO超时，另一个协程随后占用同一块共享栈挂起
+ * 超时时事件循环不能写入挂起协程的栈，recv应该在200毫秒左右返回ETIMEDOUT，而不是超时丢失后重新等待
+ * 超时一直没有生效时1秒后写入一个字节让recv返回，测试失败但不会卡住
+ */
+bool test_timeout_shared_stack()
+{
+  int sv[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  std::atomic<bool> done{false};
+  ssize_t n = 0;
+  int err = 0;
+  double ms = 0;
+  {
+    IOManager iom(1, false, "shared_stack");
+    iom.setSharedStack(true);
+    iom.scheduleLock([&]()
+                     {
+      timeval tv{0, 200000};
+      setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      auto start = std::chrono::steady_clock::now();
+      char c;
+      n = recv(sv[0], &c, 1, 0);
+      err = errno;
+      ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      done = true; });
+    iom.scheduleLock([]()
+                     {
+      // 第一个协程挂起之后反复占用共享栈
+      for (int i = 0; i < 16; ++i)
+      {
+        usleep(50 * 1000);
+      } });
+
+    auto start = std::chrono::steady_clock::now();
+    while (!done && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+    {
+      usleep(1000);
+    }
+    if (!done)
+    {
+      send(sv[1], "x", 1, 0);
+    }
+  }
+  close(sv[0]);
+  close(sv[1]);
+
+  bool ok = n == -1 && err == ETIMEDOUT && ms < 400;
+  std::cout << "shared stack recv timeout: n = " << n << ", errno = " << strerror(err) << ", after " << (int)ms
+            << " ms: " << (ok ? "PASS" : "FAIL") << std::endl;
+  return ok;
+}
+
+// 共享模式下指定线程的任务只叫醒目标线程，不能等到其它线程的超时
+bool test_pinned_wake()
+{
+  static const int THREADS = 4;
+  static const int ROUNDS = 40;
+  double worst = 0;
+  {
+    IOManager iom(THREADS, false, "pinned_wake");
+    // 所有工作线程同时阻塞在一个任务里，记下各自的线程id
+    std::vector<int> threads;
+    std::mutex mutex;
+    std::atomic<int> arrived{0};
+    for (int i = 0; i < THREADS; ++i)
+    {
+      iom.scheduleLock([&]()
+                       {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          threads.push_back(Thread::GetThreadID());
+        }
+        ++arrived;
+        while (arrived < THREADS)
+        {
+          std::this_thread::yield();
+        } });
+    }
+    while (arrived < THREADS)
+    {
+      usleep(1000);
+    }
+
+    for (int i = 0; i < ROUNDS; ++i)
+    {
+      // 等所有线程回到等待中
+      usleep(20 * 1000);
+      std::atomic<bool> done{false};
+      auto start = std::chrono::steady_clock::now();
+      iom.scheduleLock([&done]()
+                       { done = true; }, threads[i % THREADS]);
+      while (!done)
+      {
+        usleep(100);
+      }
+      worst = std::max(worst, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+  bool ok = worst < 100;
+  std::cout << "pinned task wakes its thread: worst " << worst << " ms: " << (ok ? "PASS" : "FAIL") << std::endl;
+  return ok;
+}
+
+// 分片模式下共享栈协程的sleep：定时器到期后协程必须回到原来的线程恢复
+bool test_sharded_shared_stack_sleep()
+{
+  static const int FIBERS = 200;
+  static const int SLEEPS = 4;
+  std::atomic<int> done{0}, moved{0};
+  {
+    IOManager iom(2, false, "sharded_sleep", Reactor::EPOLL, true);
+    iom.setSharedStack(true);
+    for (int i = 0; i < FIBERS; ++i)
+    {
+      iom.scheduleLock([&]()
+                       {
+        for (int k = 0; k < SLEEPS; ++k)
+        {
+          int thread = Thread::GetThreadID();
+          usleep((k + 1) * 1000);
+          if (Thread::GetThreadID() != thread)
+          {
+            ++moved;
+          }
+        }
+        ++done; });
+    }
+    while (done < FIBERS)
+    {
+      usleep(1000);
+    }
+  }
+
+  bool ok = moved == 0;
+  std::cout << "sharded shared stack sleep: " << moved << " of " << FIBERS * SLEEPS
+            << " sleeps moved threads: " << (ok ? "PASS" : "FAIL") << std::endl;
+  return ok;
+}
+
 int main(int argc, char const *argv[])
 {
+  if (!test_timeout_shared_stack())
+  {
+    return 1;
+  }
+  if (!test_pinned_wake())
+  {
+    return 1;
+  }
+  if (!test_sharded_shared_stack_sleep())
+  {
+    return 1;
+  }
+
   /*
    * 代码使用了 IOManager 来管理网络套接字的读写事件。
    * addEvent 将读写事件与回调函数关联，
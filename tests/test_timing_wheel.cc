@@ -0,0 +1,172 @@
+#include "../src/timer/timer.h"
+#include "../src/timer/timing_wheel.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace colib
+{
+  // 测试中直接构造Timer并设置超时时间
+  class TimingWheelTest
+  {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Heap = std::set<std::shared_ptr<Timer>, Timer::Comparator>;
+
+    static std::shared_ptr<Timer> make(TimerManager *manager, Clock::time_point next, std::chrono::nanoseconds slack)
+    {
+      std::shared_ptr<Timer> timer(new Timer(std::chrono::nanoseconds(0), []() {}, false, manager));
+      timer->m_next = next;
+      timer->setSlack(slack);
+      return timer;
+    }
+
+    static Clock::time_point next(const std::shared_ptr<Timer> &timer) { return timer->m_next; }
+    static Clock::time_point latest(const std::shared_ptr<Timer> &timer) { return timer->latest(); }
+  };
+}
+
+using namespace colib;
+using Clock = std::chrono::steady_clock;
+using Test = TimingWheelTest;
+
+/*
+ * 时间轮和按超时时间排序的堆（TimerManager::HEAP使用的std::set）做同样的随机操作，时间是模拟的：
+ * 插入的超时时间从亚毫秒到约4个月，覆盖所有层和最后的溢出格；时间推进的步长从1微秒到约50分钟，
+ * 有时正好推进到nextExpire，让级联在格子边界上发生
+ * 每次推进检查：取出的定时器正好是堆中超时时间不晚于现在的那些；
+ * nextExpire不晚于堆中最早的超时时间，nextWake不晚于堆中最早的最晚触发时间
+ */
+static const int STEPS = 200000;
+
+int main(int argc, char const *argv[])
+{
+  std::mt19937_64 rng(7);
+  TimerManager manager;
+  Clock::time_point origin = Clock::now();
+  Clock::time_point now = origin;
+  TimingWheel wheel(origin);
+  Test::Heap heap;
+  std::vector<std::shared_ptr<Timer>> all;
+  long errors = 0, fired = 0, cancelled = 0;
+
+  auto error = [&errors](const char *what)
+  {
+    if (++errors <= 10)
+    {
+      std::cout << "error: " << what << std::endl;
+    }
+  };
+
+  for (int step = 0; step < STEPS; ++step)
+  {
+    int op = rng() % 10;
+    if (op < 5)
+    {
+      // 插入，三分之一的定时器插入时已经过期1毫秒以内
+      static const uint64_t RANGE_MS[] = {10, 300, 20000, 2000000, 200000000, 10000000000};
+      std::chrono::nanoseconds timeout(rng() % (RANGE_MS[rng() % 6] * 1000000));
+      if (rng() % 3 == 0)
+      {
+        timeout -= std::chrono::nanoseconds(rng() % 1000000);
+      }
+      std::chrono::nanoseconds slack(rng() % 2 ? 0 : rng() % 20000000);
+      std::shared_ptr<Timer> timer = Test::make(&manager, now + timeout, slack);
+      wheel.insert(timer);
+      heap.insert(timer);
+      all.push_back(timer);
+    }
+    else if (op < 7 && !all.empty())
+    {
+      // 取消，可能是已经触发或者取消过的
+      std::shared_ptr<Timer> &timer = all[rng() % all.size()];
+      bool in_heap = heap.erase(timer) > 0;
+      bool in_wheel = wheel.remove(timer.get()) != nullptr;
+      if (in_heap != in_wheel)
+      {
+        error("remove disagrees with the heap");
+      }
+      cancelled += in_heap;
+    }
+    else
+    {
+      Clock::time_point tp;
+      bool has = wheel.nextExpire(tp);
+      if (has != !heap.empty())
+      {
+        error("nextExpire disagrees with the heap on emptiness");
+      }
+      if (has && tp > Test::next(*heap.begin()))
+      {
+        error("nextExpire is later than the earliest timer");
+      }
+      Clock::time_point wake;
+      if (wheel.nextWake(wake))
+      {
+        Clock::time_point latest = Clock::time_point::max();
+        for (const auto &timer : heap)
+        {
+          latest = std::min(latest, Test::latest(timer));
+        }
+        if (wake > latest)
+        {
+          error("nextWake is later than the earliest latest time");
+        }
+      }
+
+      static const uint64_t STEP_NS[] = {1000, 1000000, 300000000, 20000000000, 3000000000000};
+      if (has && rng() % 4 == 0)
+      {
+        now = std::max(now, tp);
+      }
+      else
+      {
+        now += std::chrono::nanoseconds(rng() % STEP_NS[rng() % 5]);
+      }
+
+      std::vector<std::shared_ptr<Timer>> expired;
+      wheel.advance(now, expired);
+      Test::Heap due;
+      while (!heap.empty() && Test::next(*heap.begin()) <= now)
+      {
+        due.insert(heap.extract(heap.begin()));
+      }
+      if (expired.size() != due.size())
+      {
+        error("advance expired a different number of timers than the heap");
+      }
+      for (const auto &timer : expired)
+      {
+        if (!due.count(timer))
+        {
+          error("advance expired a timer that is not due");
+        }
+      }
+      fired += expired.size();
+      if (wheel.size() != heap.size())
+      {
+        error("size disagrees with the heap");
+      }
+
+      // 只保留还在等待的定时器，避免取消时挑中的大多是已经结束的
+      if (all.size() > 3000)
+      {
+        all.assign(heap.begin(), heap.end());
+      }
+    }
+  }
+
+  std::vector<std::shared_ptr<Timer>> rest;
+  wheel.drain(rest);
+  if (rest.size() != heap.size() || !wheel.empty())
+  {
+    error("drain did not return every remaining timer");
+  }
+
+  std::cout << "steps " << STEPS << ", fired " << fired << ", cancelled " << cancelled << ", left " << rest.size()
+            << ", errors " << errors << std::endl;
+  std::cout << (errors ? "FAIL" : "PASS") << std::endl;
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+#include "../src/util/work_stealing_queue.h"
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace colib;
+
+/*
+ * 工作窃取队列的多线程压力测试：
+ * 拥有者线程不断push，同时自己也从top端取（和调度器的用法一样），
+ * 其它几个线程一直在窃取；初始容量只有2，push过程中会反复扩容
+ * 结束后检查每个元素恰好被取出一次
+ */
+static const int ITEMS = 1000000;
+static const int THIEVES = 3;
+static const int ROUNDS = 5;
+
+static bool run(int round)
+{
+  WorkStealingQueue<uint32_t> queue(2);
+  std::vector<std::atomic<uint8_t>> taken(ITEMS);
+  std::atomic<bool> pushing{true};
+  std::atomic<int> owner_taken{0}, stolen{0};
+
+  auto take = [&](uint32_t item, std::atomic<int> &count)
+  {
+    taken[item].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < THIEVES; ++i)
+  {
+    thieves.emplace_back([&]()
+                         {
+      uint32_t item;
+      while (pushing.load(std::memory_order_acquire) || !queue.empty())
+      {
+        if (queue.steal(item))
+        {
+          take(item, stolen);
+        }
+      } });
+  }
+
+  // 拥有者每push几个取一个，让拥有者和窃取者在队列只剩一两个元素时竞争同一个位置
+  uint32_t item;
+  for (uint32_t i = 0; i < (uint32_t)ITEMS; ++i)
+  {
+    queue.push(i);
+    if (i % 3 == 0 && queue.steal(item))
+    {
+      take(item, owner_taken);
+    }
+  }
+  while (queue.steal(item))
+  {
+    take(item, owner_taken);
+  }
+  pushing.store(false, std::memory_order_release);
+  for (auto &t : thieves)
+  {
+    t.join();
+  }
+
+  int lost = 0, dup = 0;
+  for (auto &t : taken)
+  {
+    uint8_t n = t.load(std::memory_order_relaxed);
+    lost += n == 0;
+    dup += n > 1;
+  }
+  std::cout << "round " << round << ": owner took " << owner_taken << ", thieves stole " << stolen << ", lost " << lost
+            << ", duplicated " << dup << std::endl;
+  return lost == 0 && dup == 0 && owner_taken + stolen == ITEMS;
+}
+
+int main(int argc, char const *argv[])
+{
+  bool ok = true;
+  for (int round = 0; round < ROUNDS; ++round)
+  {
+    ok = run(round) && ok;
+  }
+  std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+  return ok ? 0 : 1;
+}